@@ -4,9 +4,30 @@
 #include <functional>
 #include <algorithm>
 #include <queue>
+#include <array>
 #include <set>
+#include <vector>
+#include <memory>
 #include <stdexcept>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
 #include <cassert>
+#include <new>
+#include <thread>
+#include <exception>
+
+#include "FrozenBPlusTree.h"
+#include "BloomFilter.h"
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define BPLUSTREE_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define BPLUSTREE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define BPLUSTREE_PREFETCH(address) ((void)0)
+#endif
 
 template <typename _BPlusTree, bool is_const>
 struct BPlusTreeIterator
@@ -18,16 +39,25 @@ struct BPlusTreeIterator
 
     using Node = typename std::conditional<!is_const, NodeType, const NodeType>::type;
     using RecordIterator = typename std::conditional<!is_const, typename _BPlusTree::RecordIterator, typename _BPlusTree::RecordConstIterator>::type;
+    using Message = typename _BPlusTree::Message;
 
     Tree* tree = nullptr;
     Node* node = nullptr;
     RecordIterator record_iterator;
+    std::size_t small_index = 0u;   // position of an inline key, node is the header then
+    const Message* message = nullptr;   // a pending insert above the leaf node, instead of a record
 
-    explicit BPlusTreeIterator(Tree* tree = nullptr, Node* node = nullptr, const RecordIterator& rit = RecordIterator())
-        : tree(tree), node(node), record_iterator(rit)
+    explicit BPlusTreeIterator(Tree* tree = nullptr, Node* node = nullptr, const RecordIterator& rit = RecordIterator(), std::size_t small_index = 0u)
+        : tree(tree), node(node), record_iterator(rit), small_index(small_index)
     {
     }
 
+    // whether the iterator points to a key stored inline by a small tree
+    bool is_small() const
+    {
+        return _BPlusTree::small_capacity != 0 && tree != nullptr && node == &tree->m_header;
+    }
+
     BPlusTreeIterator(const BPlusTreeIterator&) = default;
 
     // enable non-const -> const only
@@ -39,21 +69,30 @@ struct BPlusTreeIterator
         tree = ano.tree;
         node = ano.node;
         record_iterator = ano.record_iterator;
+        small_index = ano.small_index;
+        message = ano.message;
     }
 
     const key_type& operator*() const
     {
         assert(tree != nullptr && node != nullptr);
 
+        if (is_small())
+        {
+            return tree->m_small[small_index];
+        }
+        if (message != nullptr)
+        {
+            return message->first;
+        }
+
         // the relative order should not be changed
         return record_iterator->first;
     }
 
-    const key_type& operator->() const
+    const key_type* operator->() const
     {
-        assert(tree != nullptr && node != nullptr);
-
-        return record_iterator.operator->();
+        return &**this;
     }
 
 
@@ -68,6 +107,9 @@ struct BPlusTreeIterator
         tree = ano.tree;
         node = ano.node;
         record_iterator = ano.record_iterator;
+        small_index = ano.small_index;
+        message = ano.message;
+        return *this;
     }
 
     template <bool ano_is_const>
@@ -88,7 +130,8 @@ struct BPlusTreeIterator
         }
         else
         {
-            return tree == ano.tree && node == ano.node && record_iterator == ano.record_iterator;
+            return tree == ano.tree && node == ano.node && message == ano.message
+                && (is_small() ? small_index == ano.small_index : message != nullptr || record_iterator == ano.record_iterator);
         }
     }
 
@@ -100,12 +143,27 @@ struct BPlusTreeIterator
 
     BPlusTreeIterator& operator++()
     {
-        if (tree == nullptr || tree->m_root == nullptr)
+        if (is_small())
+        {
+            if (++small_index == tree->m_size)
+            {
+                node = nullptr;
+            }
+            return *this;
+        }
+
+        if (tree == nullptr || tree->m_root == nullptr || node == nullptr)
         {
             // at the end, do nothing
             return *this;
         }
 
+        if (tree->m_pending != 0)
+        {
+            seek(&**this, true, true);
+            return *this;
+        }
+
         record_iterator++;
 
         if (record_iterator == node->records.end())
@@ -133,6 +191,41 @@ struct BPlusTreeIterator
 
     BPlusTreeIterator& operator--()
     {
+        if (_BPlusTree::small_capacity != 0 && tree != nullptr && tree->m_root == nullptr)
+        {
+            // the keys are inline, at the begin do nothing
+            if (node == nullptr && tree->m_size != 0)
+            {
+                node = &tree->m_header;
+                small_index = tree->m_size - 1;
+            }
+            else if (node != nullptr && small_index != 0)
+            {
+                small_index--;
+            }
+            return *this;
+        }
+
+        if (tree != nullptr && tree->m_root != nullptr && tree->m_pending != 0)
+        {
+            // stay at the begin if no key is before
+            BPlusTreeIterator moved = *this;
+            const key_type* bound = nullptr;
+            if (node == nullptr)
+            {
+                moved.node = tree->m_header.pre;
+            }
+            else
+            {
+                bound = &**this;
+            }
+            if (moved.seek(bound, true, false))
+            {
+                *this = moved;
+            }
+            return *this;
+        }
+
         if (tree == nullptr || tree->m_root == nullptr || (node == tree->m_header.next && record_iterator == node->records.begin()))
         {
             // at the begin, do nothing
@@ -165,10 +258,168 @@ struct BPlusTreeIterator
         --(*this);
         return old;
     }
+
+    // Move to the first key after *bound (not before it if !strict) in node and the leaves
+    // beyond it, forward or backward, merging the pending messages above each leaf into its
+    // records; bound nullptr starts at the first (last) key of node. Return false if there
+    // is none, forward the iterator is the end then.
+    bool seek(const key_type* bound, bool strict, bool forward)
+    {
+        for (; node != &tree->m_header; node = forward ? node->next : node->pre, bound = nullptr)
+        {
+            // a record is live unless the newest message of its key is an erase
+            auto live = [this](const key_type& key)
+            {
+                const Message* newest = tree->newest_message(node, key);
+                return newest == nullptr || newest->second;
+            };
+
+            RecordIterator found = node->records.end();
+            if (forward)
+            {
+                auto iter = bound == nullptr ? node->records.begin()
+                    : strict ? node->records.upper_bound(*bound) : node->records.lower_bound(*bound);
+                while (iter != node->records.end() && !live(iter->first))
+                {
+                    iter++;
+                }
+                found = iter;
+            }
+            else
+            {
+                auto iter = bound == nullptr ? node->records.end()
+                    : strict ? node->records.lower_bound(*bound) : node->records.upper_bound(*bound);
+                while (iter != node->records.begin())
+                {
+                    if (live((--iter)->first))
+                    {
+                        found = iter;
+                        break;
+                    }
+                }
+            }
+
+            // a pending insert of a key before the record
+            const key_type* limit = found == node->records.end() ? nullptr : &found->first;
+            message = tree->next_message(node, bound, strict, limit, forward);
+            if (message != nullptr || limit != nullptr)
+            {
+                record_iterator = found;
+                return true;
+            }
+        }
+
+        node = nullptr;
+        return false;
+    }
+};
+
+// ---------- Aggregate policies ----------
+// An aggregate policy is a monoid over (projected) keys:
+//   value_type, identity(), lift(key) and an associative combine(lhs, rhs).
+// Every node caches the aggregate of its subtree, so BPlusTree::query(lo, hi)
+// only combines whole subtrees and walks the two boundary paths.
+
+// maintain nothing, used by default
+template <typename T>
+struct NoAggregate
+{
+    struct value_type {};
+    static constexpr bool enabled = false;
+
+    static value_type identity() { return {}; }
+    static value_type lift(const T&) { return {}; }
+    static value_type combine(const value_type&, const value_type&) { return {}; }
+};
+
+// project a key to itself
+struct AggregateIdentity
+{
+    template <typename U>
+    const U& operator()(const U& key) const
+    {
+        return key;
+    }
+};
+
+template <typename T, typename Projection = AggregateIdentity>
+struct SumAggregate
+{
+    using value_type = typename std::decay<typename std::result_of<Projection(const T&)>::type>::type;
+    static constexpr bool enabled = true;
+
+    static value_type identity() { return value_type(); }
+    static value_type lift(const T& key) { return Projection{}(key); }
+    static value_type combine(const value_type& lhs, const value_type& rhs) { return lhs + rhs; }
+};
+
+template <typename T, typename Projection = AggregateIdentity>
+struct MinAggregate
+{
+    using value_type = typename std::decay<typename std::result_of<Projection(const T&)>::type>::type;
+    static constexpr bool enabled = true;
+    static_assert(std::numeric_limits<value_type>::is_specialized,
+                  "MinAggregate takes std::numeric_limits<value_type>::max() as its identity, write a policy for other types");
+
+    static value_type identity() { return std::numeric_limits<value_type>::max(); }
+    static value_type lift(const T& key) { return Projection{}(key); }
+    static value_type combine(const value_type& lhs, const value_type& rhs) { return rhs < lhs ? rhs : lhs; }
+};
+
+template <typename T, typename Projection = AggregateIdentity>
+struct MaxAggregate
+{
+    using value_type = typename std::decay<typename std::result_of<Projection(const T&)>::type>::type;
+    static constexpr bool enabled = true;
+    static_assert(std::numeric_limits<value_type>::is_specialized,
+                  "MaxAggregate takes std::numeric_limits<value_type>::lowest() as its identity, write a policy for other types");
+
+    static value_type identity() { return std::numeric_limits<value_type>::lowest(); }
+    static value_type lift(const T& key) { return Projection{}(key); }
+    static value_type combine(const value_type& lhs, const value_type& rhs) { return lhs < rhs ? rhs : lhs; }
+};
+
+// Hash of the keys in key order: a polynomial over the spread key hashes, so equal key sets
+// hash equal whatever the shapes of their trees. Every node holds the hash of its subtree
+// and BPlusTree::diff compares two trees by it.
+template <typename T, typename Hash = std::hash<T>>
+struct MerkleAggregate
+{
+    struct value_type
+    {
+        std::uint64_t hash = 0u;
+        std::uint64_t power = 1u;   // base ^ number of keys
+
+        bool operator==(const value_type& ano) const { return hash == ano.hash && power == ano.power; }
+        bool operator!=(const value_type& ano) const { return !(*this == ano); }
+    };
+    static constexpr bool enabled = true;
+    static constexpr std::uint64_t base = 0x9e3779b97f4a7c15ull;
+
+    static value_type identity() { return value_type(); }
+    static value_type lift(const T& key) { return value_type{ spread_hash(Hash{}(key)), base }; }
+    static value_type combine(const value_type& lhs, const value_type& rhs)
+    {
+        return value_type{ lhs.hash * rhs.power + rhs.hash, lhs.power * rhs.power };
+    }
+};
+
+// the aggregate a node caches for its subtree, nothing for a disabled policy
+template <typename Aggregate, bool enabled = Aggregate::enabled>
+struct AggregateSlot
+{
+    typename Aggregate::value_type aggregate = Aggregate::identity();
+};
+
+template <typename Aggregate>
+struct AggregateSlot<Aggregate, false>
+{
 };
 
-// key_type, order, comparator
-template <typename T, std::size_t order = 3u, typename Compare = std::less<T>>
+// key_type, order, comparator, aggregate policy, keys stored inline before the first node
+// is allocated (0: never; key_type must be default constructible otherwise)
+template <typename T, std::size_t order = 3u, typename Compare = std::less<T>, typename Aggregate = NoAggregate<T>,
+          std::size_t small_size = 0u>
 class BPlusTree
 {
     static_assert(order > 1u, "The order of B+ Tree must be at least 2");
@@ -181,13 +432,45 @@ public:
     using key_type = T;
     using size_type = std::size_t;
     using key_compare = Compare;
+    using aggregate_policy = Aggregate;
+    using aggregate_type = typename Aggregate::value_type;
     const size_type half_order = (order + 1) / 2;
     const size_type half_order_when_erase = 2 > half_order ? 2 : half_order;
 
+    // how erase rebalances the nodes
+    enum class ErasePolicy
+    {
+        EAGER,          // borrow from or merge with the slibings once a node is half full
+        MIN_FILL,       // merge only when a node drops below a minimum fill
+        FREE_AT_EMPTY   // merge only when a node becomes empty
+    };
+
+    // how an overflowed leaf is split
+    enum class SplitPolicy
+    {
+        EVEN,       // move half of the records to a new left leaf
+        SKEWED      // split unevenly while the inserts keep hitting the same end of the leaves
+    };
+
     using iterator = BPlusTreeIterator<BPlusTree, false>;
     using const_iterator = BPlusTreeIterator<BPlusTree, true>;
     using node_type = Node;
 
+    // number of lookups interleaved by find_batch and contains_batch
+    static constexpr size_type batch_group = 16u;
+
+    // least keys per worker of build_parallel, and samples per bucket to pick the splitters
+    static constexpr size_type parallel_grain = 1u << 14;
+    static constexpr size_type parallel_oversample = 64u;
+
+    // Up to small_capacity keys are kept in a sorted array inside the tree object, without
+    // a node. The tree promotes them into a root leaf once it grows beyond small_capacity,
+    // and demotes the leaves back to the array once erase leaves small_capacity / 2 keys.
+    // The array shares its storage with the header of the leaves, which a small tree has no
+    // use for, so it costs nothing while it isn't larger than a leaf node.
+    // Inserting into or erasing from the array invalidates the iterators to it.
+    static constexpr size_type small_capacity = small_size;
+
 private:
 
     friend iterator;
@@ -228,7 +511,7 @@ private:
         }
     };
 
-    struct Node
+    struct Node : public AggregateSlot<Aggregate>
     {
     public:
         using RecordPair = std::pair<key_type, Node*>; // key and child
@@ -253,42 +536,240 @@ private:
 
     using RecordIterator = typename node_type::RecordIterator;
     using RecordConstIterator = typename node_type::RecordConstIterator;
+    using RecordPair = typename node_type::RecordPair;
+    using Message = std::pair<key_type, bool>; // key, insert (true) or erase (false)
+
+    // only leaves are versioned, the header too
+    struct LeafNode : public Node
+    {
+        std::size_t version = 0u;   // renewed when records may move out of the node or be erased
+        bool cached = false;        // the lookup cache may hold entries of the node
+
+        LeafNode(const InnerCompare& comp)
+            : Node(comp)
+        {
+        }
+    };
+
+    // only inner nodes hold a write buffer
+    struct InnerNode : public Node
+    {
+        std::vector<Message> buffer;    // pending messages, oldest first
+
+        InnerNode(const InnerCompare& comp)
+            : Node(comp)
+        {
+            this->is_leaf = false;
+        }
+    };
+
+    // stands in for std::hash when it can't hash the keys, the filter is disabled then
+    struct NoHash
+    {
+        size_type operator()(const key_type&) const
+        {
+            return 0u;
+        }
+    };
+
+    using KeyHash = typename std::conditional<is_std_hashable<key_type>::value, std::hash<key_type>, NoHash>::type;
+    using SmallKeys = std::array<key_type, small_size>;
+
+    // the position of a found key, valid while the leaf keeps its version and the tree its epoch
+    struct CacheEntry
+    {
+        node_type* node = nullptr;
+        RecordIterator record;
+        size_type version = 0u;
+        size_type epoch = 0u;
+    };
+
+    static constexpr size_type cache_ways = 4u;
+
+    // the newest pending message of a key
+    enum class Pending
+    {
+        NONE, INSERT, ERASE
+    };
+
+    // leaves from start on are predicted at start + slope * (key - first)
+    struct LearnedSegment
+    {
+        key_type first;
+        double slope;
+        size_type start;
+    };
+
+    // estimated cost of an element of the record container besides the value: three links
+    // and a color, as in the common red-black tree implementations
+    static constexpr size_type estimated_record_overhead = 4 * sizeof(void*);
 
 public:
     BPlusTree()
-        : m_innercomp(KeyRawCompare()), m_header(m_innercomp)
+        : m_innercomp(KeyRawCompare())
     {
+        construct_storage();
         clear();
     }
 
     BPlusTree(const KeyRawCompare& keycomp)
-        : m_innercomp(keycomp), m_header(m_innercomp)
+        : m_innercomp(keycomp)
     {
+        construct_storage();
         clear();
     }
 
-    // TODO: CopyContructor, CopyAssign, MoveConstructor, MoveAssign
+    BPlusTree(BPlusTree&& ano)
+        : m_innercomp(ano.m_innercomp)
+    {
+        construct_storage();
+        take_over(ano);
+    }
+
+    BPlusTree& operator=(BPlusTree&& ano)
+    {
+        if (this != &ano)
+        {
+            clear();
+            m_innercomp = ano.m_innercomp;
+            take_over(ano);
+        }
+        return *this;
+    }
+
+    // TODO: CopyContructor, CopyAssign
 
     ~BPlusTree()
     {
         clear();
+        if (is_small())
+        {
+            m_small.~SmallKeys();
+        }
+        else
+        {
+            m_header.~LeafNode();
+        }
     }
 
     // return { iterator pointing to inserted key, inserted or not (key exitses) }
     std::pair<iterator, bool> insert(const key_type& key)
+    {
+        if (is_small())
+        {
+            const size_type index = small_lower_bound(key);
+            if (index < m_size && !m_innercomp(key, m_small[index]))
+            {
+                return { make_small_iterator(index), false };
+            }
+            if (m_size < small_size)
+            {
+                std::move_backward(m_small.begin() + index, m_small.begin() + m_size, m_small.begin() + m_size + 1);
+                m_small[index] = key;
+                m_size++;
+                return { make_small_iterator(index), true };
+            }
+            promote();
+        }
+
+        const Pending pending = purge(key);
+        auto result = insert_key(key);
+        if (pending != Pending::NONE)
+        {
+            result.second = pending == Pending::ERASE;
+        }
+        return result;
+    }
+
+    iterator erase(iterator pos)
+    {
+        //assert(pos.tree == this);
+
+        if (m_size == 0)
+        {
+            throw std::underflow_error("remove from empty BPlusTree");
+        }
+
+        if (pos.is_small())
+        {
+            small_erase_at(pos.small_index);
+            return make_small_iterator(pos.small_index);
+        }
+
+        if (pos.message != nullptr)
+        {
+            // a pending insert, no record to unlink
+            const key_type to_delete_key = pos.message->first;
+            erase(to_delete_key);
+            return lower_bound(to_delete_key);
+        }
+
+        auto to_delete_key = pos.record_iterator->first;
+
+        // the erase supersedes the pending messages of the key
+        for (node_type* node = pos.node->parent; node != nullptr; node = node->parent)
+        {
+            purge_buffer(node, to_delete_key);
+        }
+
+        erase_record(pos.node, pos.record_iterator);
+        demote();
+
+        return lower_bound(to_delete_key);
+    }
+
+    iterator erase(const_iterator pos)
+    {
+        if (pos.is_small())
+        {
+            return erase(make_small_iterator(pos.small_index));
+        }
+        if (pos.message != nullptr)
+        {
+            iterator mutable_pos{ this, const_cast<Node*>(pos.node) };
+            mutable_pos.message = pos.message;
+            return erase(mutable_pos);
+        }
+        return erase(make_iterator_uncheck(const_cast<Node*>(pos.node), const_cast<typename std::remove_cv<decltype(pos.node->records)>::type&>
+            (pos.node->records).erase(pos.record_iterator, pos.record_iterator)));
+    }
+
+    // return the number of erased keys (0 or 1), descend only once
+    size_type erase(const key_type& key)
+    {
+        if (is_small())
+        {
+            const size_type index = small_lower_bound(key);
+            if (index == m_size || m_innercomp(key, m_small[index]))
+            {
+                return 0;
+            }
+            small_erase_at(index);
+            return 1;
+        }
+
+        const Pending pending = purge(key);
+        const size_type erased = erase_key(key);
+        demote();
+        return pending == Pending::NONE ? erased : pending == Pending::INSERT ? 1u : 0u;
+    }
+
+private:
+    std::pair<iterator, bool> insert_key(const key_type& key)
     {
         if (m_root == nullptr)
         {
-            m_root = make_node();
-            m_root->is_leaf = true;
+            set_root(make_node(true));
 
             m_root->next = m_root->pre = &m_header;
             m_header.next = m_root;
             m_header.pre = m_root;
 
             m_root->records.insert(std::make_pair(key, nullptr));
+            update_aggregate(m_root);
 
             m_size++;
+            filter_insert(key);
 
             return { make_iterator_uncheck(m_root, m_root->records.begin()), true };
         }
@@ -321,15 +802,22 @@ public:
                 {
                     find_result = cur->records.insert(std::make_pair(key, nullptr)).first;
                     m_size++;
+                    filter_insert(key);
+
+                    if (split_policy() == SplitPolicy::SKEWED)
+                    {
+                        track_insert_position(cur, find_result);
+                    }
 
                     if (cur->records.size() <= order)
                     {
+                        update_aggregate_path(cur);
                         return { make_iterator_uncheck(cur, find_result), true };
                     }
                     else // split the leaf
                     {
                         node_type* insert_node = nullptr;
-                        auto split_result = split(cur);
+                        auto split_result = split(cur, split_count(true));
                         if (m_innercomp(key, cur->records.begin()->first)) // in left
                         {
                             insert_node = split_result.second;
@@ -344,8 +832,9 @@ public:
 
                         while (cur != nullptr && cur->records.size() > order)
                         {
-                            cur = split(cur).first;
+                            cur = split(cur, split_count(false)).first;
                         }
+                        update_aggregate_path(cur);
                         return { make_iterator_uncheck(insert_node, find_result), true };
                     }
                 }
@@ -353,83 +842,236 @@ public:
         }
     }
 
-    iterator erase(iterator pos)
+    size_type erase_key(const key_type& key)
     {
-        //assert(pos.tree == this);
-
-        if (m_size == 0)
+        auto cur = m_root;
+        while (cur != nullptr && !cur->is_leaf)
         {
-            throw std::underflow_error("remove from empty BPlusTree");
+            auto find_result = cur->records.lower_bound(key);
+            if (find_result == cur->records.end())
+            {
+                return 0;
+            }
+            cur = find_result->second;
         }
 
-        m_size--;
-
-        if (m_size == 0)
+        if (cur == nullptr)
         {
-            clear();
-            return make_iterator();
+            return 0;
         }
-        else
-        {
-            auto to_delete_key = pos.record_iterator->first;
-
-            node_type* node = pos.node;
-            RecordIterator record_iterator = pos.record_iterator;
 
-            while (erase_helper(node, record_iterator));
-
-            while (!m_root->is_leaf && m_root->records.size() == 1)
-            {
-                auto tmp = m_root->records.begin()->second;
-                delete m_root;
-                m_root = tmp;
-                tmp->parent = nullptr;
-            }
-
-            return lower_bound(to_delete_key);
+        auto find_result = cur->records.find(key);
+        if (find_result == cur->records.end())
+        {
+            return 0;
         }
 
+        erase_record(cur, find_result);
+        return 1;
     }
 
-    iterator erase(const_iterator pos)
+public:
+    // Erase all keys satisfying pred in one sweep over the leaves, then repack the
+    // underfull leaves and rebuild the separators in a single pass.
+    // Return the number of erased keys.
+    template <typename Predicate>
+    friend size_type erase_if(BPlusTree& tree, Predicate pred)
     {
-        return erase(make_iterator_uncheck(const_cast<Node*>(pos.node), const_cast<typename std::remove_cv<decltype(pos.node->records)>::type&>
-            (pos.node->records).erase(pos.record_iterator, pos.record_iterator)));
-    }
+        tree.flush();
 
-    iterator find(const key_type& key)
-    {
-        auto cur = m_root;
-        while (cur != nullptr)
+        size_type erased = 0;
+        if (tree.is_small())
         {
-            if (!cur->is_leaf)
+            size_type kept = 0;
+            for (size_type i = 0; i < tree.m_size; i++)
             {
-                auto find_result = cur->records.lower_bound(key);
-                if (find_result == cur->records.end())
+                if (!pred(tree.m_small[i]))
                 {
-                    return make_iterator();
+                    tree.m_small[kept++] = std::move(tree.m_small[i]);
                 }
-                cur = find_result->second;
             }
-            else
+            erased = tree.m_size - kept;
+            std::fill(tree.m_small.begin() + kept, tree.m_small.begin() + tree.m_size, key_type());
+            tree.m_size = kept;
+            return erased;
+        }
+
+        for (auto leaf = tree.m_header.next; leaf != &tree.m_header; leaf = leaf->next)
+        {
+            for (auto iter = leaf->records.begin(), end = leaf->records.end(); iter != end; )
             {
-                auto find_result = cur->records.find(key);
-                if (find_result != cur->records.end())
+                if (pred(iter->first))
                 {
-                    return make_iterator_uncheck(cur, find_result);
+                    iter = leaf->records.erase(iter);
+                    erased++;
                 }
                 else
                 {
-                    return make_iterator();
+                    iter++;
                 }
             }
         }
-        return make_iterator();
-    }
 
-    iterator lower_bound(const key_type& key)
-    {
-        node_type* last_split_point = nullptr;
+        if (erased == 0)
+        {
+            return 0;
+        }
+
+        tree.m_size -= erased;
+        tree.count_filter_changes(erased);
+        if (tree.m_size == 0)
+        {
+            tree.clear();
+        }
+        else
+        {
+            tree.refresh_filter();
+            tree.rebuild_from_leaves(tree.half_order);
+            tree.demote();
+        }
+        return erased;
+    }
+
+    iterator find(const key_type& key)
+    {
+        if (is_small())
+        {
+            const size_type index = small_lower_bound(key);
+            return index < m_size && !m_innercomp(key, m_small[index]) ? make_small_iterator(index) : make_iterator();
+        }
+
+        if (m_pending != 0)
+        {
+            // the cache and the filter only know the records
+            return find_pending<iterator>(this, key);
+        }
+
+        if (filter_rejects(key))
+        {
+            return make_iterator();
+        }
+
+        CacheEntry* set = nullptr;
+        if (m_extras != nullptr && !m_extras->cache.empty())
+        {
+            set = &m_extras->cache[(spread_hash(KeyHash{}(key)) & (m_extras->cache.size() / cache_ways - 1)) * cache_ways];
+            for (size_type i = 0; i < cache_ways; i++)
+            {
+                if (cache_hit(set[i], key))
+                {
+                    m_extras->cache_stats.hits++;
+                    return make_iterator_uncheck(set[i].node, set[i].record);
+                }
+            }
+            m_extras->cache_stats.misses++;
+        }
+
+        iterator result = find_in_tree(key);
+        if (set != nullptr && result.node != nullptr)
+        {
+            set[m_extras->cache_stats.misses % cache_ways] = CacheEntry{ result.node, result.record_iterator, version_of(result.node), m_extras->cache_epoch };
+            static_cast<LeafNode*>(result.node)->cached = true;
+        }
+        return result;
+    }
+
+    // Look up [first, last) in groups of batch_group keys which descend level by level
+    // in lockstep, each one prefetching its next node before switching to the others.
+    // Write an iterator (end() if absent) for every key to out.
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out)
+    {
+        if (is_small() || m_pending != 0)
+        {
+            for (; first != last; ++first)
+            {
+                *out++ = find(*first);
+            }
+            return out;
+        }
+
+        const key_type* keys[batch_group];
+        node_type* nodes[batch_group];
+
+        while (first != last)
+        {
+            size_type n = 0;
+            for (; n < batch_group && first != last; ++n, ++first)
+            {
+                keys[n] = &*first;
+            }
+
+            find_leaves_batch(keys, nodes, n);
+
+            for (size_type i = 0; i < n; i++)
+            {
+                if (nodes[i] == nullptr)
+                {
+                    *out++ = make_iterator();
+                    continue;
+                }
+
+                auto find_result = nodes[i]->records.find(*keys[i]);
+                *out++ = find_result != nodes[i]->records.end() ? make_iterator_uncheck(nodes[i], find_result) : make_iterator();
+            }
+        }
+        return out;
+    }
+
+    // same as find_batch, but write whether each key exists to out
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt contains_batch(ForwardIt first, ForwardIt last, OutputIt out) const
+    {
+        if (is_small() || m_pending != 0)
+        {
+            for (; first != last; ++first)
+            {
+                *out++ = contains(*first);
+            }
+            return out;
+        }
+
+        const key_type* keys[batch_group];
+        node_type* nodes[batch_group];
+
+        while (first != last)
+        {
+            size_type n = 0;
+            for (; n < batch_group && first != last; ++n, ++first)
+            {
+                keys[n] = &*first;
+            }
+
+            find_leaves_batch(keys, nodes, n);
+
+            for (size_type i = 0; i < n; i++)
+            {
+                *out++ = nodes[i] != nullptr && nodes[i]->records.find(*keys[i]) != nodes[i]->records.end();
+            }
+        }
+        return out;
+    }
+
+    iterator lower_bound(const key_type& key)
+    {
+        if (is_small())
+        {
+            return make_small_iterator(small_lower_bound(key));
+        }
+
+        if (m_pending != 0)
+        {
+            return seek_pending<iterator>(this, key, false);
+        }
+
+        if (learned_index() != 0)
+        {
+            node_type* leaf = learned_leaf(key, false);
+            if (leaf != nullptr)
+            {
+                return make_iterator(leaf, leaf->records.lower_bound(key));
+            }
+        }
 
         node_type* cur = m_root;
         while (cur != nullptr)
@@ -439,14 +1081,15 @@ public:
                 auto find_result = cur->records.lower_bound(key);
                 if (find_result == cur->records.end())
                 {
-                    return make_iterator();
+                    // a stale separator may be greater than the keys in its child
+                    --find_result;
                 }
                 cur = find_result->second;
             }
             else
             {
                 auto find_result = cur->records.lower_bound(key);
-                return make_iterator_uncheck(cur, find_result);
+                return make_iterator(cur, find_result);
             }
         }
 
@@ -455,7 +1098,24 @@ public:
 
     iterator upper_bound(const key_type& key)
     {
-        node_type* last_split_point = nullptr;
+        if (is_small())
+        {
+            return make_small_iterator(static_cast<size_type>(std::upper_bound(m_small.begin(), m_small.begin() + m_size, key, m_innercomp) - m_small.begin()));
+        }
+
+        if (m_pending != 0)
+        {
+            return seek_pending<iterator>(this, key, true);
+        }
+
+        if (learned_index() != 0)
+        {
+            node_type* leaf = learned_leaf(key, true);
+            if (leaf != nullptr)
+            {
+                return make_iterator(leaf, leaf->records.upper_bound(key));
+            }
+        }
 
         node_type* cur = m_root;
         while (cur != nullptr)
@@ -465,7 +1125,8 @@ public:
                 auto find_result = cur->records.upper_bound(key);
                 if (find_result == cur->records.end())
                 {
-                    return make_iterator();
+                    // a stale separator may be greater than the keys in its child
+                    --find_result;
                 }
                 cur = find_result->second;
             }
@@ -481,13 +1142,21 @@ public:
 
     std::pair<iterator, iterator> equal_range(const key_type& key)
     {
-        auto lb = lower_bound(key);
-        return std::make_pair(lower_bound(key), ++lb);
+        return std::make_pair(lower_bound(key), upper_bound(key));
     }
 
     // --------------- iterator ---------------
+
+    // applies the pending messages first, so a traversal steps over plain records instead of
+    // merging the buffers on the path at every step; this invalidates the iterators like an
+    // insert. The const begin() can't, its iterators merge.
     iterator begin()
     {
+        if (is_small())
+        {
+            return make_small_iterator(0u);
+        }
+        flush();
         return m_size == 0 ? end() : make_iterator_uncheck(m_header.next, m_header.next->records.begin());
     }
 
@@ -496,130 +1165,2993 @@ public:
         return make_iterator();
     }
 
-    const_iterator begin() const
-    {
-        return m_size == 0 ? end() : make_iterator_uncheck(m_header.next, m_header.next->records.begin());
+    const_iterator begin() const
+    {
+        if (is_small())
+        {
+            return make_small_iterator(0u);
+        }
+        if (m_pending != 0)
+        {
+            const_iterator result{ this, m_header.next };
+            result.seek(nullptr, false, true);
+            return result;
+        }
+        return m_size == 0 ? end() : make_iterator_uncheck(m_header.next, m_header.next->records.begin());
+    }
+
+    const_iterator end() const
+    {
+        return make_iterator();
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    // --------------- leaf scan ---------------
+
+    // the records of a leaf, the key in first
+    using leaf_record_iterator = RecordConstIterator;
+
+    // Visit the keys of [lo, hi] a leaf at a time: visit(first, last) gets the records of one
+    // leaf within the range, ascending, and walks them without the checks the iterators make
+    // per key. reverse visits the leaves from the last one, each range still ascending. The
+    // next leaf is prefetched before visit runs. Pending messages are flushed first, which
+    // invalidates the iterators like an insert; visit must not change the tree.
+    template <typename Visitor>
+    void scan(const key_type& lo, const key_type& hi, Visitor visit, bool reverse = false)
+    {
+        static_assert(small_size == 0, "scan hands out leaf records, a small tree keeps its keys inline");
+
+        flush();
+        if (m_root == nullptr || m_innercomp(hi, lo))
+        {
+            return;
+        }
+
+        if (!reverse)
+        {
+            const node_type* leaf = lookup_leaf(lo, false);
+            leaf_record_iterator first = leaf->records.lower_bound(lo);
+            while (true)
+            {
+                if (!leaf->records.empty())
+                {
+                    // only the last leaf of the range needs a bound
+                    const bool bounded = m_innercomp(hi, max_key_of(leaf));
+                    const leaf_record_iterator last = bounded ? leaf->records.upper_bound(hi) : leaf->records.end();
+                    if (!bounded)
+                    {
+                        BPLUSTREE_PREFETCH(leaf->next);
+                    }
+                    if (first != last)
+                    {
+                        visit(first, last);
+                    }
+                    if (bounded)
+                    {
+                        return;
+                    }
+                }
+                leaf = leaf->next;
+                if (leaf == &m_header)
+                {
+                    return;
+                }
+                first = leaf->records.begin();
+            }
+        }
+
+        const node_type* leaf = lookup_leaf(hi, true);
+        leaf_record_iterator last = leaf->records.upper_bound(hi);
+        while (true)
+        {
+            if (!leaf->records.empty())
+            {
+                const bool bounded = m_innercomp(leaf->records.begin()->first, lo);
+                const leaf_record_iterator first = bounded ? leaf->records.lower_bound(lo) : leaf->records.begin();
+                if (!bounded)
+                {
+                    BPLUSTREE_PREFETCH(leaf->pre);
+                }
+                if (first != last)
+                {
+                    visit(first, last);
+                }
+                if (bounded)
+                {
+                    return;
+                }
+            }
+            leaf = leaf->pre;
+            if (leaf == &m_header)
+            {
+                return;
+            }
+            last = leaf->records.end();
+        }
+    }
+
+    // visit all keys a leaf at a time, see scan above
+    template <typename Visitor>
+    void scan(Visitor visit, bool reverse = false)
+    {
+        static_assert(small_size == 0, "scan hands out leaf records, a small tree keeps its keys inline");
+
+        flush();
+        if (m_root == nullptr)
+        {
+            return;
+        }
+        for (const node_type* leaf = reverse ? m_header.pre : m_header.next; leaf != &m_header; )
+        {
+            const node_type* following = reverse ? leaf->pre : leaf->next;
+            BPLUSTREE_PREFETCH(following);
+            if (!leaf->records.empty())
+            {
+                visit(leaf->records.begin(), leaf->records.end());
+            }
+            leaf = following;
+        }
+    }
+
+    // --------------- const version ---------------
+
+    // The const lookups only read the tree: they neither fill nor count the lookup cache,
+    // so they are safe to call from several threads while no one writes.
+
+    const_iterator find(const key_type& key) const
+    {
+        if (is_small())
+        {
+            const size_type index = small_lower_bound(key);
+            return index < m_size && !m_innercomp(key, m_small[index]) ? make_small_iterator(index) : make_iterator();
+        }
+        if (m_pending != 0)
+        {
+            return find_pending<const_iterator>(this, key);
+        }
+        if (m_root == nullptr || filter_rejects(key))
+        {
+            return make_iterator();
+        }
+
+        const node_type* leaf = lookup_leaf(key, false);
+        auto find_result = leaf->records.find(key);
+        return find_result != leaf->records.end() ? make_iterator_uncheck(leaf, find_result) : make_iterator();
+    }
+
+    const_iterator lower_bound(const key_type& key) const
+    {
+        if (is_small())
+        {
+            return make_small_iterator(small_lower_bound(key));
+        }
+        if (m_pending != 0)
+        {
+            return seek_pending<const_iterator>(this, key, false);
+        }
+        if (m_root == nullptr)
+        {
+            return make_iterator();
+        }
+
+        const node_type* leaf = lookup_leaf(key, false);
+        return make_iterator(leaf, leaf->records.lower_bound(key));
+    }
+
+    const_iterator upper_bound(const key_type& key) const
+    {
+        if (is_small())
+        {
+            return make_small_iterator(static_cast<size_type>(std::upper_bound(m_small.begin(), m_small.begin() + m_size, key, m_innercomp) - m_small.begin()));
+        }
+        if (m_pending != 0)
+        {
+            return seek_pending<const_iterator>(this, key, true);
+        }
+        if (m_root == nullptr)
+        {
+            return make_iterator();
+        }
+
+        const node_type* leaf = lookup_leaf(key, true);
+        return make_iterator(leaf, leaf->records.upper_bound(key));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    // --------------- aggregate ---------------
+
+    // combine the aggregate of all keys in [lo, hi], in key order
+    aggregate_type query(const key_type& lo, const key_type& hi) const
+    {
+        static_assert(Aggregate::enabled, "query requires an aggregate policy");
+
+        aggregate_type result = Aggregate::identity();
+        if (m_pending != 0)
+        {
+            // the cached aggregates only cover the records
+            for (auto iter = lower_bound(lo), last = end(); iter != last && !m_innercomp(hi, *iter); iter++)
+            {
+                result = Aggregate::combine(result, Aggregate::lift(*iter));
+            }
+        }
+        else if (is_small())
+        {
+            for (size_type i = small_lower_bound(lo); i < m_size && !m_innercomp(hi, m_small[i]); i++)
+            {
+                result = Aggregate::combine(result, Aggregate::lift(m_small[i]));
+            }
+        }
+        else if (m_root != nullptr && !m_innercomp(hi, lo))
+        {
+            query_helper(m_root, lo, hi, false, false, result);
+        }
+        return result;
+    }
+
+    // aggregate of the whole tree
+    aggregate_type aggregate() const
+    {
+        static_assert(Aggregate::enabled, "aggregate requires an aggregate policy");
+
+        if (is_small() || m_pending != 0)
+        {
+            aggregate_type result = Aggregate::identity();
+            for (auto iter = begin(), last = end(); iter != last; iter++)
+            {
+                result = Aggregate::combine(result, Aggregate::lift(*iter));
+            }
+            return result;
+        }
+        return m_root == nullptr ? Aggregate::identity() : m_root->aggregate;
+    }
+
+    // Write every key which is in only one of this tree and other as { key, in this tree }
+    // to out, in key order. A subtree of this tree is skipped when its aggregate equals the
+    // aggregate of other over the same key range, so with MerkleAggregate the cost grows
+    // with the number of differences times log n, not with the size of the trees.
+    template <typename OutputIt>
+    OutputIt diff(const BPlusTree& other, OutputIt out) const
+    {
+        static_assert(Aggregate::enabled, "diff requires an aggregate policy, such as MerkleAggregate");
+
+        if (is_small() || other.is_small() || m_pending != 0 || other.m_pending != 0)
+        {
+            // one side has at most small_size keys, the other one is walked anyway; the
+            // cached aggregates don't cover the pending messages
+            return diff_merge(other, out);
+        }
+        if (m_root == nullptr)
+        {
+            for (auto iter = other.begin(), end = other.end(); iter != end; iter++)
+            {
+                *out++ = std::make_pair(*iter, false);
+            }
+            return out;
+        }
+        diff_helper(m_root, nullptr, nullptr, other, out);
+        return out;
+    }
+
+    // --------------- freeze ---------------
+
+    // copy all keys into an immutable, pointer-free layout for read-only use
+    FrozenBPlusTree<key_type, Compare> freeze() const
+    {
+        std::vector<key_type> keys;
+        keys.reserve(m_size);
+        for (auto iter = begin(), last = end(); iter != last; iter++)
+        {
+            keys.push_back(*iter);
+        }
+        return FrozenBPlusTree<key_type, Compare>(keys.begin(), keys.end(), m_innercomp.keycomp);
+    }
+
+    // copy all integral keys into the same layout with leaves of bit-packed differences,
+    // see FrozenPackedLeaves
+    FrozenBPlusTree<key_type, Compare, FrozenPackedLeaves<key_type>> freeze_packed() const
+    {
+        static_assert(std::is_same<Compare, std::less<key_type>>::value, "freeze_packed requires std::less");
+
+        std::vector<key_type> keys;
+        keys.reserve(m_size);
+        for (auto iter = begin(), last = end(); iter != last; iter++)
+        {
+            keys.push_back(*iter);
+        }
+        return FrozenBPlusTree<key_type, Compare, FrozenPackedLeaves<key_type>>(keys.begin(), keys.end());
+    }
+
+    // --------------- parallel construction ---------------
+
+    // Build a tree of the keys in [first, last), in any order, with threads workers (0: one
+    // per hardware thread). The keys are sample sorted: every worker counts and scatters
+    // its chunk into buckets cut by sampled splitters, then sorts one bucket and drops its
+    // duplicates. The workers build full leaves of the sorted buckets, which are linked in
+    // one chain under one set of inner layers. Of equal keys the first one in the input is
+    // kept, as an insert loop would. key_type must be default constructible.
+    template <typename RandomIt>
+    static BPlusTree build_parallel(RandomIt first, RandomIt last, size_type threads = 0u, const KeyRawCompare& keycomp = KeyRawCompare())
+    {
+        BPlusTree result(keycomp);
+        const size_type n = static_cast<size_type>(last - first);
+        if (n <= small_size)
+        {
+            for (; first != last; ++first)
+            {
+                result.insert(*first);
+            }
+            return result;
+        }
+
+        if (threads == 0)
+        {
+            threads = std::max(size_type(std::thread::hardware_concurrency()), size_type(1u));
+        }
+        // a worker is not worth starting for less than parallel_grain keys
+        threads = std::max(std::min(threads, n / parallel_grain), size_type(1u));
+
+        // threads - 1 splitters from evenly spaced samples, equal keys share a bucket
+        const InnerCompare& comp = result.m_innercomp;
+        std::vector<key_type> splitters;
+        if (threads > 1)
+        {
+            const size_type sample_count = threads * parallel_oversample;
+            std::vector<key_type> samples;
+            samples.reserve(sample_count);
+            for (size_type i = 0; i < sample_count; i++)
+            {
+                samples.push_back(first[i * n / sample_count]);
+            }
+            std::sort(samples.begin(), samples.end(), comp);
+            for (size_type i = 1; i < threads; i++)
+            {
+                splitters.push_back(samples[i * parallel_oversample]);
+            }
+        }
+        auto bucket_of = [&](const key_type& key)
+        {
+            return static_cast<size_type>(std::upper_bound(splitters.begin(), splitters.end(), key, comp) - splitters.begin());
+        };
+
+        // counts[t * threads + b]: keys of chunk t in bucket b, then where chunk t writes them
+        std::vector<size_type> counts(threads * threads, 0u);
+        run_parallel(threads, [&](size_type t)
+        {
+            for (size_type i = t * n / threads, end = (t + 1) * n / threads; i < end; i++)
+            {
+                counts[t * threads + bucket_of(first[i])]++;
+            }
+        });
+
+        std::vector<size_type> bucket_begin(threads + 1, 0u);
+        size_type offset = 0u;
+        for (size_type b = 0; b < threads; b++)
+        {
+            bucket_begin[b] = offset;
+            for (size_type t = 0; t < threads; t++)
+            {
+                const size_type count = counts[t * threads + b];
+                counts[t * threads + b] = offset;
+                offset += count;
+            }
+        }
+        bucket_begin[threads] = n;
+
+        // the chunks are scattered in input order and sorted stably, so the first of equal keys survives
+        std::vector<key_type> keys(n);
+        run_parallel(threads, [&](size_type t)
+        {
+            for (size_type i = t * n / threads, end = (t + 1) * n / threads; i < end; i++)
+            {
+                keys[counts[t * threads + bucket_of(first[i])]++] = first[i];
+            }
+        });
+
+        std::vector<size_type> bucket_end(threads);
+        run_parallel(threads, [&](size_type b)
+        {
+            auto begin = keys.begin() + bucket_begin[b], end = keys.begin() + bucket_begin[b + 1];
+            std::stable_sort(begin, end, comp);
+            end = std::unique(begin, end, [&](const key_type& lhs, const key_type& rhs) { return !comp(lhs, rhs); });
+            bucket_end[b] = static_cast<size_type>(end - keys.begin());
+        });
+
+        // unique_begin[b]: position of the first key of bucket b among all unique keys
+        std::vector<size_type> unique_begin(threads + 1, 0u);
+        for (size_type b = 0; b < threads; b++)
+        {
+            unique_begin[b + 1] = unique_begin[b] + bucket_end[b] - bucket_begin[b];
+        }
+        const size_type size = unique_begin[threads];
+        if (size <= small_size)
+        {
+            for (size_type b = 0; b < threads; b++)
+            {
+                for (size_type i = bucket_begin[b]; i < bucket_end[b]; i++)
+                {
+                    result.insert(keys[i]);
+                }
+            }
+            return result;
+        }
+
+        // spread the keys evenly over full leaves, every worker builds a run of them
+        const size_type leaf_count = (size + order - 1) / order;
+        std::vector<node_type*> nodes(leaf_count, nullptr);
+        try
+        {
+            run_parallel(threads, [&](size_type t)
+            {
+                const size_type leaf_first = t * leaf_count / threads, leaf_last = (t + 1) * leaf_count / threads;
+                size_type position = leaf_first * (size / leaf_count) + std::min(leaf_first, size % leaf_count);
+                size_type b = static_cast<size_type>(std::upper_bound(unique_begin.begin(), unique_begin.end(), position) - unique_begin.begin()) - 1;
+                size_type i = bucket_begin[b] + position - unique_begin[b];
+
+                for (size_type leaf_index = leaf_first; leaf_index < leaf_last; leaf_index++)
+                {
+                    node_type* leaf = result.make_node(true);
+                    nodes[leaf_index] = leaf;
+                    for (size_type count = size / leaf_count + (leaf_index < size % leaf_count ? 1 : 0); count > 0; count--)
+                    {
+                        while (i == bucket_end[b])
+                        {
+                            i = bucket_begin[++b];
+                        }
+                        leaf->records.insert(leaf->records.end(), RecordPair(std::move(keys[i++]), nullptr));
+                    }
+                    result.update_aggregate(leaf);
+                }
+            });
+        }
+        catch (...)
+        {
+            for (node_type* leaf : nodes)
+            {
+                delete static_cast<LeafNode*>(leaf);
+            }
+            throw;
+        }
+
+        node_type* pre = nullptr;
+        for (node_type* leaf : nodes)
+        {
+            leaf->pre = pre;
+            if (pre != nullptr)
+            {
+                pre->next = leaf;
+            }
+            pre = leaf;
+        }
+        node_type* front = nodes.front();
+
+        // the header comes with the root in a small tree
+        result.set_root(result.build_inner_layers(nodes));
+        result.m_root->parent = nullptr;
+        front->pre = &result.m_header;
+        result.m_header.next = front;
+        pre->next = &result.m_header;
+        result.m_header.pre = pre;
+        result.m_size = size;
+        return result;
+    }
+
+    // --------------- split & join ---------------
+
+    // Move all keys not less than key into a new tree. Only the nodes on the path to key
+    // are cut, the pieces on each side are joined back in O(log n) node operations.
+    // Counting the moved keys walks the leaves of the smaller side.
+    BPlusTree split_off(const key_type& key)
+    {
+        BPlusTree result(m_innercomp.keycomp);
+        if (m_extras != nullptr)
+        {
+            // the leaves moving to result keep the versions given by this tree
+            result.m_extras = m_extras->settings();
+            result.m_extras->version_clock = m_extras->version_clock;
+        }
+        flush();
+        if (is_small())
+        {
+            const size_type index = small_lower_bound(key);
+            for (size_type i = index; i < m_size; i++)
+            {
+                result.insert(m_small[i]);
+            }
+            std::fill(m_small.begin() + index, m_small.begin() + m_size, key_type());
+            m_size = index;
+            return result;
+        }
+        if (m_root == nullptr)
+        {
+            return result;
+        }
+
+        detach_leaf_ends();
+
+        // cut every node on the path, children before the path go left, the others go right
+        std::vector<node_type*> lefts, rights;
+        for (node_type* cur = m_root; cur != nullptr; )
+        {
+            node_type* right = make_node(cur->is_leaf);
+
+            RecordIterator cut = cur->records.lower_bound(key);
+            node_type* child = nullptr;
+            if (!cur->is_leaf)
+            {
+                if (cut == cur->records.end())
+                {
+                    --cut;
+                }
+                child = cut->second;
+                cut = cur->records.erase(cut);
+            }
+
+            while (cut != cur->records.end())
+            {
+                if (cut->second != nullptr)
+                {
+                    cut->second->parent = right;
+                }
+                right->records.insert(right->records.end(), std::move(*cut));
+                cut = cur->records.erase(cut);
+            }
+
+            right->next = cur->next;
+            if (cur->next != nullptr)
+            {
+                cur->next->pre = right;
+            }
+            cur->next = nullptr;
+
+            lefts.push_back(cur);
+            rights.push_back(right);
+            cur = child;
+        }
+
+        for (size_type i = lefts.size(); i-- > 0; )
+        {
+            update_aggregate(lefts[i]);
+            update_aggregate(rights[i]);
+        }
+
+        // the keys grow from the top left piece down to the leaves, then up to the top right piece
+        const size_type height = lefts.size() - 1;
+        Piece left, right;
+        for (size_type i = 0; i <= height; i++)
+        {
+            left = join_pieces(left, make_piece(lefts[i], height - i));
+        }
+        for (size_type i = height + 1; i-- > 0; )
+        {
+            right = join_pieces(right, make_piece(rights[i], height - i));
+        }
+
+        // count the smaller side
+        const size_type total = m_size;
+        size_type left_size = 0u, right_size = 0u;
+        node_type* left_leaf = left.root == nullptr ? nullptr : last_leaf_of(left.root);
+        node_type* right_leaf = right.root == nullptr ? nullptr : first_leaf_of(right.root);
+        for (; left_leaf != nullptr && right_leaf != nullptr; left_leaf = left_leaf->pre, right_leaf = right_leaf->next)
+        {
+            left_size += left_leaf->records.size();
+            right_size += right_leaf->records.size();
+        }
+        if (left_leaf == nullptr)
+        {
+            right_size = total - left_size;
+        }
+        else
+        {
+            left_size = total - right_size;
+        }
+
+        set_root(nullptr);
+        adopt(left, left_size);
+        result.adopt(right, right_size);
+        demote();
+        result.demote();
+        return result;
+    }
+
+    // Append all keys of ano, which must be greater than the keys in this tree. The root
+    // of the lower tree is linked into the border path of the higher one, O(log n).
+    void join(BPlusTree&& ano)
+    {
+        flush();
+        ano.flush();
+
+        if (is_small() || ano.is_small())
+        {
+            join_small(ano);
+            return;
+        }
+        if (ano.m_root == nullptr)
+        {
+            return;
+        }
+        if (m_root == nullptr)
+        {
+            take_over(ano);
+            return;
+        }
+        if (!m_innercomp(m_header.pre->records.rbegin()->first, ano.m_header.next->records.begin()->first))
+        {
+            throw std::invalid_argument("join BPlusTree with keys not greater than the keys in this one");
+        }
+
+        const size_type total = m_size + ano.m_size;
+        Piece left{ m_root, tree_height() }, right{ ano.m_root, ano.tree_height() };
+
+        // stale separators on the right border may be greater than the keys of ano
+        for (node_type* node = m_root; !node->is_leaf; node = node->records.rbegin()->second)
+        {
+            const_cast<key_type&>(node->records.rbegin()->first) = m_header.pre->records.rbegin()->first;
+        }
+
+        if (ano.m_extras != nullptr)
+        {
+            // the leaves of ano keep the versions given by its tree
+            own_extras().version_clock = std::max(own_extras().version_clock, ano.m_extras->version_clock);
+        }
+        detach_leaf_ends();
+        ano.detach_leaf_ends();
+        ano.set_root(nullptr);
+        ano.clear();
+
+        Piece joined = join_pieces(left, right);
+        set_root(nullptr);
+        adopt(joined, total);
+    }
+
+    // ------------------------------------------------
+    // O(pending * log n) while messages are pending, see set_write_buffer
+    size_type size() const
+    {
+        return m_pending == 0 ? m_size : resolved_size();
+    }
+
+    bool empty() const
+    {
+        return m_pending == 0 ? m_size == 0 : begin() == end();
+    }
+
+    // whether the keys are stored inline, see small_capacity
+    bool is_small() const
+    {
+        return small_size != 0 && m_root == nullptr;
+    }
+
+    void clear()
+    {
+        if (is_small())
+        {
+            // split_off and join detach the nodes before clearing, the inline keys are unused then
+            std::fill(m_small.begin(), m_small.begin() + std::min(m_size, small_size), key_type());
+        }
+        clear_helper(m_root);
+        set_root(nullptr);
+        if (!is_small())
+        {
+            reset_header();
+        }
+        m_size = 0u;
+        m_pending = 0u;
+        if (m_extras != nullptr)
+        {
+            m_extras->compact_cursor = nullptr;
+            m_extras->cache_epoch++;
+            reset_learned_index();
+            m_extras->filter.clear();
+            m_extras->filter_changes = 0u;
+        }
+    }
+
+    // --------------- erase policy ---------------
+
+    // Select how erase rebalances. The relaxed policies only merge a node with a slibing
+    // once it drops below min_fill records (FREE_AT_EMPTY: once it's empty), never borrow,
+    // and let the separators go stale. Going back to EAGER repacks the tree.
+    void set_erase_policy(ErasePolicy policy, size_type min_fill = 1u)
+    {
+        const bool repack = policy == ErasePolicy::EAGER && erase_policy() != ErasePolicy::EAGER;
+        if (repack)
+        {
+            flush();
+        }
+
+        Extras& extras = own_extras();
+        extras.erase_policy = policy;
+        extras.min_fill = policy == ErasePolicy::MIN_FILL ? std::max(std::min(min_fill, half_order), size_type(1u)) : 1u;
+
+        if (repack && m_root != nullptr)
+        {
+            rebuild_from_leaves(half_order);
+            extras.compact_cursor = nullptr;
+        }
+    }
+
+    ErasePolicy erase_policy() const
+    {
+        return m_extras != nullptr ? m_extras->erase_policy : ErasePolicy::EAGER;
+    }
+
+    // --------------- split policy ---------------
+
+    // Select how leaves are split. With SKEWED, once two inserts in a row land on the last
+    // (first) position of a leaf, an overflowed leaf keeps skew of its records on the left
+    // (right) side, so an ascending (descending) key stream leaves full leaves behind.
+    // skew = 1.0 starts a new leaf with the inserted key only. Inner nodes keep at least
+    // half_order children on both sides.
+    void set_split_policy(SplitPolicy policy, double skew = 0.9)
+    {
+        Extras& extras = own_extras();
+        extras.split_policy = policy;
+        extras.split_skew = std::max(std::min(skew, 1.0), 0.5);
+        extras.append_run = extras.prepend_run = 0u;
+    }
+
+    SplitPolicy split_policy() const
+    {
+        return m_extras != nullptr ? m_extras->split_policy : SplitPolicy::EVEN;
+    }
+
+    // --------------- write buffer ---------------
+
+    // Let every inner node hold up to capacity pending insert/erase messages. buffer_insert
+    // and buffer_erase only append a message to the root; a full buffer is sorted and
+    // pushed one level down in a batch, the bottom inner nodes apply theirs to the leaves.
+    // The lookups merge the pending messages into the records instead of flushing them; the
+    // iterators they return then scan the buffers above their leaf on every step, so the
+    // non-const begin() flushes before a traversal.
+    // capacity = 0 disables buffering and flushes all messages.
+    void set_write_buffer(size_type capacity)
+    {
+        own_extras().buffer_capacity = capacity;
+        if (capacity == 0)
+        {
+            flush();
+        }
+    }
+
+    size_type write_buffer() const
+    {
+        return m_extras != nullptr ? m_extras->buffer_capacity : 0u;
+    }
+
+    // number of pending messages
+    size_type pending() const
+    {
+        return m_pending;
+    }
+
+    void buffer_insert(const key_type& key)
+    {
+        if (write_buffer() == 0 || m_root == nullptr || m_root->is_leaf)
+        {
+            insert(key);
+            return;
+        }
+
+        push_message(m_root, Message(key, true));
+        if (buffer_of(m_root).size() > write_buffer())
+        {
+            flush_from(m_root, write_buffer());
+        }
+    }
+
+    void buffer_erase(const key_type& key)
+    {
+        if (write_buffer() == 0 || m_root == nullptr || m_root->is_leaf)
+        {
+            erase(key);
+            return;
+        }
+
+        push_message(m_root, Message(key, false));
+        if (buffer_of(m_root).size() > write_buffer())
+        {
+            flush_from(m_root, write_buffer());
+        }
+    }
+
+    // whether key exists, the newest message on the path wins over the leaf
+    bool contains(const key_type& key) const
+    {
+        if (is_small())
+        {
+            const size_type index = small_lower_bound(key);
+            return index < m_size && !m_innercomp(key, m_small[index]);
+        }
+
+        // the filter only knows the keys in the leaves
+        if (m_pending == 0 && filter_rejects(key))
+        {
+            return false;
+        }
+
+        for (const node_type* cur = m_root; cur != nullptr; )
+        {
+            if (cur->is_leaf)
+            {
+                return cur->records.find(key) != cur->records.end();
+            }
+
+            const std::vector<Message>& buffer = buffer_of(cur);
+            for (auto iter = buffer.rbegin(), end = buffer.rend(); iter != end; iter++)
+            {
+                if (equal_key(iter->first, key))
+                {
+                    return iter->second;
+                }
+            }
+
+            auto find_result = cur->records.lower_bound(key);
+            if (find_result == cur->records.end())
+            {
+                return false;
+            }
+            cur = find_result->second;
+        }
+        return false;
+    }
+
+    // apply all pending messages to the leaves
+    void flush()
+    {
+        if (m_pending != 0)
+        {
+            flush_from(m_root, 0u);
+        }
+    }
+
+    // --------------- bloom filter ---------------
+
+    // Keep a blocked Bloom filter of the keys with bits_per_key bits each, find and contains
+    // return end() / false without a descent when the filter proves a key absent. Erased
+    // keys stay in the filter; an insert rebuilds it once the inserts and erases since the
+    // last build exceed half of the keys it was sized for, so do erase_if and shrink_to_fit.
+    // The lookups only probe it.
+    // std::hash<key_type> must agree with Compare on equal keys. 0 disables the filter.
+    void set_bloom_filter(size_type bits_per_key)
+    {
+        static_assert(is_std_hashable<key_type>::value, "the bloom filter requires std::hash<key_type>");
+
+        Extras& extras = own_extras();
+        extras.filter_bits = bits_per_key;
+        extras.filter.clear();
+        if (bits_per_key != 0)
+        {
+            flush();
+            rebuild_filter();
+        }
+    }
+
+    size_type bloom_filter() const
+    {
+        return m_extras != nullptr ? m_extras->filter_bits : 0u;
+    }
+
+    // --------------- lookup cache ---------------
+
+    struct CacheStats
+    {
+        size_type hits = 0u;
+        size_type misses = 0u;
+
+        double hit_rate() const
+        {
+            return hits + misses == 0 ? 0.0 : double(hits) / double(hits + misses);
+        }
+    };
+
+    // Remember the leaf positions of found keys in a 4-way set-associative cache of entries
+    // positions (rounded up to a power of two), find checks it before any descent. An entry
+    // is valid while its leaf keeps its version: splits, erases, borrows, merges and repacks
+    // give the leaves they take records from a new one, drawn from a counter of the tree, so
+    // a leaf allocated where a freed one was doesn't match its entries either. A change in
+    // one leaf leaves the entries of the others valid; clear() and moves drop them all.
+    // std::hash<key_type> selects the set. 0 disables it.
+    void set_lookup_cache(size_type entries)
+    {
+        static_assert(is_std_hashable<key_type>::value, "the lookup cache requires std::hash<key_type>");
+
+        size_type size = entries == 0 ? 0u : cache_ways;
+        while (size < entries)
+        {
+            size *= 2;
+        }
+        Extras& extras = own_extras();
+        extras.cache.assign(size, CacheEntry());
+        extras.cache.shrink_to_fit();
+        extras.cache_stats = CacheStats();
+    }
+
+    size_type lookup_cache() const
+    {
+        return m_extras != nullptr ? m_extras->cache.size() : 0u;
+    }
+
+    CacheStats cache_stats() const
+    {
+        return m_extras != nullptr ? m_extras->cache_stats : CacheStats();
+    }
+
+    void reset_cache_stats()
+    {
+        if (m_extras != nullptr)
+        {
+            m_extras->cache_stats = CacheStats();
+        }
+    }
+
+    // --------------- learned index ---------------
+
+    // Route find, lower_bound and upper_bound through a piecewise-linear model of the leaf
+    // chain instead of the inner nodes. The model is fitted to the first keys of a snapshot
+    // of the leaves, every segment predicts the position of a leaf within epsilon, so only
+    // 2 * epsilon + 2 first keys are searched; a short walk along the leaves corrects the
+    // result when inserts have moved keys since the snapshot. A split keeps the snapshot
+    // usable, freeing a leaf invalidates it. An invalid model is refitted by the non-const
+    // lookups after as many of them as the snapshot had leaves, or by rebuild_learned_index;
+    // the const lookups only read a valid model and descend otherwise. epsilon = 0 disables
+    // the model.
+    void set_learned_index(size_type epsilon)
+    {
+        static_assert(std::is_arithmetic<key_type>::value, "the learned index requires an arithmetic key type");
+
+        own_extras().learned_epsilon = epsilon;
+        if (epsilon == 0)
+        {
+            reset_learned_index();
+        }
+        else
+        {
+            rebuild_learned_index();
+        }
+    }
+
+    size_type learned_index() const
+    {
+        return m_extras != nullptr ? m_extras->learned_epsilon : 0u;
+    }
+
+    // fit the model to the current leaves
+    void rebuild_learned_index()
+    {
+        flush();
+        build_learned_index(std::is_arithmetic<key_type>());
+    }
+
+    // number of linear segments, 0 if the model is disabled or invalid
+    size_type learned_segments() const
+    {
+        return m_extras != nullptr && m_extras->learned_valid ? m_extras->learned_segments.size() : 0u;
+    }
+
+    // --------------- memory ---------------
+
+    struct MemoryFootprint
+    {
+        size_type node_bytes = 0u;    // Node objects, including the header and the feature state
+        size_type record_bytes = 0u;  // elements of the record containers, except the keys, estimated
+        size_type key_bytes = 0u;     // keys in leaf and inner records
+        size_type leaf_count = 0u;
+        size_type inner_count = 0u;
+        size_type leaf_record_count = 0u;
+        size_type buffer_bytes = 0u;  // pending messages of the inner nodes
+        size_type learned_bytes = 0u; // leaf snapshot and segments of the learned index
+        size_type filter_bytes = 0u;  // bits of the bloom filter
+        size_type cache_bytes = 0u;   // entries of the lookup cache
+
+        size_type total() const
+        {
+            return node_bytes + record_bytes + key_bytes + buffer_bytes + learned_bytes + filter_bytes + cache_bytes;
+        }
+
+        // average fill of the leaves, in [0, 1]
+        double leaf_fill() const
+        {
+            return leaf_count == 0 ? 0.0 : double(leaf_record_count) / double(leaf_count * order);
+        }
+    };
+
+    // Bytes of the nodes, records and keys, and of the feature state. The objects are counted
+    // by their sizes; the record elements are an estimate, since std::set doesn't expose its
+    // node type: three links and a color besides the key and the child pointer. The padding
+    // the allocator adds to every block is not counted.
+    MemoryFootprint memory_footprint() const
+    {
+        MemoryFootprint footprint;
+        footprint.node_bytes = std::max(sizeof(LeafNode), sizeof(SmallKeys));   // the header or the inline keys
+        if (m_extras != nullptr)
+        {
+            footprint.node_bytes += sizeof(Extras);
+            footprint.learned_bytes = m_extras->learned_leaves.capacity() * sizeof(node_type*)
+                + m_extras->learned_keys.capacity() * sizeof(key_type)
+                + m_extras->learned_segments.capacity() * sizeof(LearnedSegment);
+            footprint.filter_bytes = m_extras->filter.memory_footprint();
+            footprint.cache_bytes = m_extras->cache.capacity() * sizeof(CacheEntry);
+        }
+
+        std::queue<const node_type*> q;
+        if (m_root != nullptr)
+        {
+            q.push(m_root);
+        }
+
+        while (!q.empty())
+        {
+            auto cur = q.front();
+            q.pop();
+
+            footprint.node_bytes += cur->is_leaf ? sizeof(LeafNode) : sizeof(InnerNode);
+            footprint.record_bytes += cur->records.size() * (estimated_record_overhead + sizeof(RecordPair) - sizeof(key_type));
+            footprint.key_bytes += cur->records.size() * sizeof(key_type);
+
+            if (cur->is_leaf)
+            {
+                footprint.leaf_count++;
+                footprint.leaf_record_count += cur->records.size();
+            }
+            else
+            {
+                footprint.inner_count++;
+                footprint.buffer_bytes += buffer_of(cur).capacity() * sizeof(Message);
+                for (auto iter = cur->records.begin(), end = cur->records.end(); iter != end; iter++)
+                {
+                    q.push(iter->second);
+                }
+            }
+        }
+
+        return footprint;
+    }
+
+    // Repack the leaves so that each one holds target_fill * order records, rounded and at
+    // least half_order, but the last two which share the rest: fuller leaves are split and
+    // emptier ones are topped up. Rebuild the inner layers and return the number of bytes
+    // freed, negative when the split leaves take more than the merged ones gave back.
+    std::ptrdiff_t shrink_to_fit(double target_fill = 1.0)
+    {
+        flush();
+        if (m_root == nullptr)
+        {
+            return 0;
+        }
+        if (bloom_filter() != 0)
+        {
+            rebuild_filter();
+        }
+
+        const size_type before = memory_footprint().total();
+        rebuild_from_leaves(target_fill_count(target_fill), true);
+        if (m_extras != nullptr)
+        {
+            m_extras->compact_cursor = nullptr;
+        }
+        return static_cast<std::ptrdiff_t>(before) - static_cast<std::ptrdiff_t>(memory_footprint().total());
+    }
+
+    // Incremental compaction for a background caller: visit at most budget leaves from where
+    // the previous call stopped, merging each one with the next leaf when both fit in
+    // target_fill * order records, whether or not they share a parent. Inner nodes are
+    // rebalanced as in erase. Return true when the end of the leaves is reached.
+    bool compact_step(size_type budget, double target_fill = 1.0)
+    {
+        flush();
+        const size_type fill = target_fill_count(target_fill);
+
+        Extras& extras = own_extras();
+        node_type* leaf = extras.compact_cursor != nullptr ? extras.compact_cursor : first_leaf();
+        for (; budget > 0 && leaf != &m_header; budget--)
+        {
+            node_type* right = leaf->next;
+            if (right == &m_header || leaf->records.size() + right->records.size() > fill)
+            {
+                leaf = right;
+                continue;
+            }
+
+            if (right->parent != leaf->parent)
+            {
+                // the leaf absorbs the first child of the next parent: the entry of right is
+                // erased from its parent, then the separators above the leaf are raised to
+                // cover the moved keys, which is safe for every policy
+                auto right_in_parent = entry_in_parent(right);
+                const key_type last_key = (--right->records.end())->first;
+
+                for (auto iter = right->records.begin(), end = right->records.end(); iter != end; iter++)
+                {
+                    leaf->records.insert(leaf->records.end(), std::move(*iter));
+                }
+                bump_version(leaf);
+                update_aggregate(leaf);
+
+                leaf->next = right->next;
+                right->next->pre = leaf;
+                node_type* right_parent = right->parent;
+                free_node(right);
+
+                const_cast<node_type*&>(right_in_parent->second) = nullptr;
+                erase_entry(right_parent, right_in_parent);
+                fix_key_on_path(leaf, last_key);
+                update_aggregate_path(leaf);
+                continue;
+            }
+
+            // the right one absorbs the leaf, then the entry of leaf is erased from parent
+            auto leaf_in_parent = entry_in_parent(leaf);
+
+            for (auto iter = leaf->records.rbegin(), end = leaf->records.rend(); iter != end; iter++)
+            {
+                right->records.insert(right->records.begin(), std::move(*iter));
+            }
+            update_aggregate(right);
+
+            leaf->pre->next = right;
+            right->pre = leaf->pre;
+            free_node(leaf);
+
+            const_cast<node_type*&>(leaf_in_parent->second) = nullptr;
+            erase_entry(right->parent, leaf_in_parent);
+            leaf = right;
+        }
+
+        extras.compact_cursor = leaf != &m_header ? leaf : nullptr;
+        return leaf == &m_header;
+    }
+
+    void print() const
+    {
+        if (is_small())
+        {
+            std::cout << "[";
+            for (size_type i = 0; i < m_size; i++)
+            {
+                std::cout << (i == 0 ? "" : ",") << m_small[i];
+            }
+            std::cout << "]\n";
+            return;
+        }
+        if (m_root == nullptr)
+        {
+            return;
+        }
+
+        std::queue<node_type*> q;
+        q.push(m_root);
+
+        while (!q.empty())
+        {
+            auto cur = q.front();
+            q.pop();
+
+            std::cout << "[";
+            auto iter = cur->records.begin(), end = cur->records.end();
+            for (int i = 0; i < cur->records.size() - 1; i++)
+            {
+                std::cout << iter->first << ",";
+                if (iter->second != nullptr)
+                {
+                    q.push(iter->second);
+                }
+                iter++;
+            }
+            std::cout << iter->first << "]";
+            if (iter->second != nullptr)
+            {
+                q.push(iter->second);
+            }
+            if (cur->next == nullptr || cur->next == &m_header)
+            {
+                std::cout << "\n";
+            }
+        }
+    }
+
+private:
+    void clear_helper(node_type* node)
+    {
+        if (node == nullptr)
+        {
+            return;
+        }
+
+        for (auto iter = node->records.begin(), end = node->records.end(); iter != end; iter++)
+        {
+            clear_helper(iter->second);
+        }
+
+        free_node(node);
+    }
+
+    void reset_header()
+    {
+        m_header.next = m_header.pre = &m_header;
+    }
+
+    // the header while the tree has no root, the inline keys of a small tree otherwise
+    void construct_storage()
+    {
+        if (small_size != 0)
+        {
+            new (&m_small) SmallKeys();
+        }
+        else
+        {
+            new (&m_header) LeafNode(m_innercomp);
+            reset_header();
+        }
+    }
+
+    // A small tree keeps its keys inline while it has no root, and the header links the
+    // leaves once it has one: switch the storage they share when the root comes or goes.
+    void set_root(node_type* root)
+    {
+        if (small_size != 0 && (m_root == nullptr) != (root == nullptr))
+        {
+            if (root == nullptr)
+            {
+                m_header.~LeafNode();
+                new (&m_small) SmallKeys();
+            }
+            else
+            {
+                m_small.~SmallKeys();
+                new (&m_header) LeafNode(m_innercomp);
+                reset_header();
+            }
+        }
+        m_root = root;
+    }
+
+    // the first leaf, the header if there is none; a small tree has no header to read
+    node_type* first_leaf()
+    {
+        return m_root != nullptr ? m_header.next : &m_header;
+    }
+
+    // number of records per leaf for a fill factor in (0, 1]
+    size_type target_fill_count(double target_fill) const
+    {
+        size_type fill = static_cast<size_type>(target_fill * order + 0.5);
+        return std::max(std::min(fill, order), half_order);
+    }
+
+    // record of node in its parent
+    RecordIterator entry_in_parent(const node_type* node) const
+    {
+        auto iter = node->records.empty() ? node->parent->records.begin() : node->parent->records.lower_bound(node->records.begin()->first);
+        while (iter->second != node)
+        {
+            iter++;
+        }
+        return iter;
+    }
+
+    // remove a record from a leaf and rebalance the tree
+    void erase_record(node_type* node, RecordIterator record_iterator)
+    {
+        m_size--;
+        count_filter_changes(1u);
+
+        if (m_size == 0)
+        {
+            // keep the pending messages, they are applied to the empty tree after the
+            // messages being applied now
+            std::vector<Message> messages = take_all_messages();
+            clear();
+            if (m_extras != nullptr && m_extras->applying != nullptr)
+            {
+                m_extras->applying->insert(m_extras->applying->end(), messages.begin(), messages.end());
+            }
+            else
+            {
+                apply_messages(messages);
+            }
+            return;
+        }
+
+        erase_entry(node, record_iterator);
+    }
+
+    // remove a record from a node, rebalance the tree and shrink the root
+    void erase_entry(node_type* node, RecordIterator record_iterator)
+    {
+        while (erase_helper(node, record_iterator));
+
+        while (!m_root->is_leaf && m_root->records.size() == 1)
+        {
+            auto tmp = m_root->records.begin()->second;
+            std::vector<Message>& buffer = buffer_of(m_root);
+            if (!buffer.empty())
+            {
+                if (tmp->is_leaf)
+                {
+                    break;  // keep the root until its messages are applied
+                }
+                // the messages of the root are newer
+                buffer_of(tmp).insert(buffer_of(tmp).end(), buffer.begin(), buffer.end());
+            }
+            free_node(m_root);
+            m_root = tmp;
+            tmp->parent = nullptr;
+        }
+    }
+
+    // Repack the leaf chain so that every leaf holds at least half_order records (except a
+    // single root leaf) and at most fill ones, then rebuild all the inner layers. The leaves
+    // below fill are topped up from the next ones; with split_fuller the ones above fill
+    // are cut too, so all leaves but the last two hold exactly fill records.
+    // Empty leaves are allowed in the chain, but the tree must not be empty.
+    void rebuild_from_leaves(size_type fill, bool split_fuller = false)
+    {
+        fill = std::max(std::min(fill, order), half_order);
+
+        // drop the inner layers, they are linked layer by layer
+        for (node_type* first = m_root; !first->is_leaf; )
+        {
+            node_type* next_first = first->records.begin()->second;
+            for (node_type* node = first; node != nullptr; )
+            {
+                node_type* next = node->next;
+                free_node(node);
+                node = next;
+            }
+            first = next_first;
+        }
+
+        std::vector<node_type*> nodes;
+        node_type* cur = nullptr;
+        for (node_type* leaf = m_header.next; leaf != &m_header; )
+        {
+            node_type* next = leaf->next;
+            if (cur != nullptr && cur->records.size() < fill)
+            {
+                // move records into cur until it's packed
+                while (!leaf->records.empty() && cur->records.size() < fill)
+                {
+                    cur->records.insert(cur->records.end(), std::move(*leaf->records.begin()));
+                    leaf->records.erase(leaf->records.begin());
+                }
+            }
+
+            if (leaf->records.empty())
+            {
+                free_node(leaf);
+            }
+            else
+            {
+                nodes.push_back(leaf);
+                cur = leaf;
+            }
+
+            // the records beyond fill go to new leaves, the last one is topped up next
+            while (split_fuller && cur != nullptr && cur->records.size() > fill)
+            {
+                node_type* piece = make_node(true);
+                for (auto iter = std::next(cur->records.begin(), fill), end = cur->records.end(); iter != end; )
+                {
+                    piece->records.insert(piece->records.end(), std::move(*iter));
+                    iter = cur->records.erase(iter);
+                }
+                nodes.push_back(piece);
+                cur = piece;
+            }
+            leaf = next;
+        }
+
+        // the last leaf is merged into or borrows from its left one
+        if (nodes.size() > 1 && nodes.back()->records.size() < half_order)
+        {
+            node_type* last = nodes.back();
+            node_type* left = nodes[nodes.size() - 2];
+            if (left->records.size() + last->records.size() <= order)
+            {
+                for (auto iter = last->records.begin(), end = last->records.end(); iter != end; )
+                {
+                    left->records.insert(left->records.end(), std::move(*iter));
+                    iter = last->records.erase(iter);
+                }
+                free_node(last);
+                nodes.pop_back();
+            }
+            else
+            {
+                while (last->records.size() < half_order)
+                {
+                    auto left_last_iter = --left->records.end();
+                    last->records.insert(last->records.begin(), std::move(*left_last_iter));
+                    left->records.erase(left_last_iter);
+                }
+            }
+        }
+
+        node_type* pre = &m_header;
+        for (node_type* leaf : nodes)
+        {
+            leaf->pre = pre;
+            pre->next = leaf;
+            bump_version(leaf);
+            update_aggregate(leaf);
+            pre = leaf;
+        }
+        pre->next = &m_header;
+        m_header.pre = pre;
+
+        m_root = build_inner_layers(nodes);
+        m_root->parent = nullptr;
+    }
+
+    // run work(0) ... work(threads - 1) on threads threads, the calling one included, and
+    // rethrow the first exception once all of them are done
+    template <typename Work>
+    static void run_parallel(size_type threads, const Work& work)
+    {
+        std::vector<std::exception_ptr> errors(threads);
+        auto guarded = [&](size_type t)
+        {
+            try
+            {
+                work(t);
+            }
+            catch (...)
+            {
+                errors[t] = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        for (size_type t = 1; t < threads; t++)
+        {
+            workers.emplace_back(guarded, t);
+        }
+        guarded(0u);
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+
+        for (auto& error : errors)
+        {
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    // a subtree detached from the tree, leaves are in height 0
+    struct Piece
+    {
+        node_type* root = nullptr;
+        size_type height = 0u;
+    };
+
+    size_type tree_height() const
+    {
+        size_type height = 0u;
+        for (node_type* cur = m_root; cur != nullptr && !cur->is_leaf; cur = cur->records.begin()->second)
+        {
+            height++;
+        }
+        return height;
+    }
+
+    static node_type* first_leaf_of(node_type* node)
+    {
+        while (!node->is_leaf)
+        {
+            node = node->records.begin()->second;
+        }
+        return node;
+    }
+
+    static node_type* last_leaf_of(node_type* node)
+    {
+        while (!node->is_leaf)
+        {
+            node = node->records.rbegin()->second;
+        }
+        return node;
+    }
+
+    static const key_type& max_key_of(const node_type* node)
+    {
+        return node->records.rbegin()->first;
+    }
+
+    // --------------- small tree helpers ---------------
+
+    size_type small_lower_bound(const key_type& key) const
+    {
+        return static_cast<size_type>(std::lower_bound(m_small.begin(), m_small.begin() + m_size, key, m_innercomp) - m_small.begin());
+    }
+
+    iterator make_small_iterator(size_type index)
+    {
+        return index < m_size ? iterator{ this, &m_header, RecordIterator(), index } : make_iterator();
+    }
+
+    const_iterator make_small_iterator(size_type index) const
+    {
+        return index < m_size ? const_iterator{ this, &m_header, RecordConstIterator(), index } : make_iterator();
+    }
+
+    void small_erase_at(size_type index)
+    {
+        std::move(m_small.begin() + index + 1, m_small.begin() + m_size, m_small.begin() + index);
+        m_small[--m_size] = key_type();
+    }
+
+    // move the inline keys into a root leaf
+    void promote()
+    {
+        // the root leaf takes over the storage of the inline keys
+        SmallKeys keys;
+        std::move(m_small.begin(), m_small.begin() + m_size, keys.begin());
+        const size_type size = m_size;
+        m_size = 0u;
+        for (size_type i = 0; i < size; i++)
+        {
+            insert_key(keys[i]);
+        }
+    }
+
+    // move the keys back inline once they fit in half of small_size, so that a tree around
+    // small_size keys doesn't promote and demote on every other call
+    void demote()
+    {
+        if (small_size == 0 || m_root == nullptr || m_size > small_size / 2 || m_pending != 0)
+        {
+            return;
+        }
+
+        // the header goes with the root, collect the keys first
+        SmallKeys keys;
+        size_type size = 0u;
+        for (auto leaf = m_header.next; leaf != &m_header; leaf = leaf->next)
+        {
+            for (auto iter = leaf->records.begin(), end = leaf->records.end(); iter != end; iter++)
+            {
+                keys[size++] = iter->first;
+            }
+        }
+        clear();
+        std::move(keys.begin(), keys.begin() + size, m_small.begin());
+        m_size = size;
+    }
+
+    // join when either tree is small, its keys are inserted one by one into the other
+    void join_small(BPlusTree& ano)
+    {
+        if (m_size != 0 && ano.m_size != 0)
+        {
+            auto last = end();
+            --last;
+            if (!m_innercomp(*last, *ano.begin()))
+            {
+                throw std::invalid_argument("join BPlusTree with keys not greater than the keys in this one");
+            }
+        }
+
+        if (ano.is_small())
+        {
+            for (size_type i = 0; i < ano.m_size; i++)
+            {
+                insert(ano.m_small[i]);
+            }
+            ano.clear();
+            return;
+        }
+
+        for (size_type i = 0; i < m_size; i++)
+        {
+            ano.insert(m_small[i]);
+        }
+        clear();
+        take_over(ano);
+    }
+
+    // diff by walking both trees in key order
+    template <typename OutputIt>
+    OutputIt diff_merge(const BPlusTree& other, OutputIt out) const
+    {
+        auto lhs = begin(), lhs_end = end();
+        auto rhs = other.begin(), rhs_end = other.end();
+        while (lhs != lhs_end || rhs != rhs_end)
+        {
+            if (rhs == rhs_end || (lhs != lhs_end && m_innercomp(*lhs, *rhs)))
+            {
+                *out++ = std::make_pair(*lhs++, true);
+            }
+            else if (lhs == lhs_end || m_innercomp(*rhs, *lhs))
+            {
+                *out++ = std::make_pair(*rhs++, false);
+            }
+            else
+            {
+                ++lhs;
+                ++rhs;
+            }
+        }
+        return out;
+    }
+
+    // take all nodes of ano, which becomes empty
+    void take_over(BPlusTree& ano)
+    {
+        if (ano.is_small())
+        {
+            std::move(ano.m_small.begin(), ano.m_small.begin() + ano.m_size, m_small.begin());
+        }
+        set_root(ano.m_root);
+        m_size = ano.m_size;
+        m_pending = ano.m_pending;
+        m_extras = std::move(ano.m_extras);
+        if (m_extras != nullptr)
+        {
+            m_extras->cache_epoch++;
+        }
+        reset_learned_index();
+        if (m_root != nullptr)
+        {
+            m_header.next = ano.m_header.next;
+            m_header.pre = ano.m_header.pre;
+            m_header.next->pre = &m_header;
+            m_header.pre->next = &m_header;
+        }
+
+        ano.set_root(nullptr);
+        ano.clear();
+    }
+
+    // --------------- write buffer helpers ---------------
+
+    bool equal_key(const key_type& lhs, const key_type& rhs) const
+    {
+        return !m_innercomp(lhs, rhs) && !m_innercomp(rhs, lhs);
+    }
+
+    // lowering a separator would strand the pending messages above it, so the separators
+    // are only kept exact by the eager policy without a write buffer
+    bool exact_separators() const
+    {
+        return erase_policy() == ErasePolicy::EAGER && write_buffer() == 0 && m_pending == 0;
+    }
+
+    // --------------- pending message helpers ---------------
+    // The reads merge the pending messages into the records instead of flushing them. A
+    // message is in a buffer above the leaf its key is routed to, the higher buffers and
+    // the later messages in one buffer are newer.
+
+    // the leaf key is routed to, read only
+    const node_type* leaf_of(const key_type& key) const
+    {
+        const node_type* cur = m_root;
+        while (!cur->is_leaf)
+        {
+            auto child = cur->records.lower_bound(key);
+            if (child == cur->records.end())
+            {
+                --child;
+            }
+            cur = child->second;
+        }
+        return cur;
+    }
+
+    node_type* leaf_of(const key_type& key)
+    {
+        return const_cast<node_type*>(static_cast<const BPlusTree*>(this)->leaf_of(key));
+    }
+
+    // the leaf holding the lower (upper) bound of key for a const lookup, found by a valid
+    // learned index or a descent
+    const node_type* lookup_leaf(const key_type& key, bool upper) const
+    {
+        const node_type* leaf = learned_leaf(key, upper);
+        return leaf != nullptr ? leaf : leaf_of(key);
+    }
+
+    // the newest message of key above leaf, nullptr if none
+    const Message* newest_message(const node_type* leaf, const key_type& key) const
+    {
+        const Message* newest = nullptr;
+        for (const node_type* cur = leaf->parent; cur != nullptr; cur = cur->parent)
+        {
+            const std::vector<Message>& buffer = buffer_of(cur);
+            for (auto iter = buffer.rbegin(), end = buffer.rend(); iter != end; iter++)
+            {
+                if (equal_key(iter->first, key))
+                {
+                    newest = &*iter;
+                    break;
+                }
+            }
+        }
+        return newest;
+    }
+
+    // Of the keys routed to leaf after *bound (not before it if !strict) and before *limit,
+    // forward or backward, the first one whose newest message is an insert; return that
+    // message, nullptr if none. Every buffer above leaf is scanned once per candidate.
+    const Message* next_message(const node_type* leaf, const key_type* bound, bool strict, const key_type* limit, bool forward) const
+    {
+        auto before = [this, forward](const key_type& lhs, const key_type& rhs)
+        {
+            return forward ? m_innercomp(lhs, rhs) : m_innercomp(rhs, lhs);
+        };
+
+        // the keys routed to leaf are in (*lo, *hi], nullptr is unbounded
+        const key_type* lo = nullptr;
+        const key_type* hi = nullptr;
+        for (const node_type* child = leaf; child->parent != nullptr; child = child->parent)
+        {
+            auto entry = entry_in_parent(child);
+            if (hi == nullptr && std::next(entry) != child->parent->records.end())
+            {
+                hi = &entry->first;
+            }
+            if (lo == nullptr && entry != child->parent->records.begin())
+            {
+                lo = &std::prev(entry)->first;
+            }
+        }
+
+        while (true)
+        {
+            const Message* first = nullptr;
+            for (const node_type* cur = leaf->parent; cur != nullptr; cur = cur->parent)
+            {
+                for (const Message& message : buffer_of(cur))
+                {
+                    const key_type& key = message.first;
+                    if (!message.second || (lo != nullptr && !m_innercomp(*lo, key)) || (hi != nullptr && m_innercomp(*hi, key))
+                        || (bound != nullptr && (strict ? !before(*bound, key) : before(key, *bound)))
+                        || (limit != nullptr && !before(key, *limit))
+                        || (first != nullptr && !before(key, first->first)))
+                    {
+                        continue;
+                    }
+                    first = &message;
+                }
+            }
+
+            if (first == nullptr)
+            {
+                return nullptr;
+            }
+            const Message* newest = newest_message(leaf, first->first);
+            if (newest->second)
+            {
+                return newest;
+            }
+            // erased again, go on after it
+            bound = &first->first;
+            strict = true;
+        }
+    }
+
+    // find key with the pending messages merged, Tree is BPlusTree or const BPlusTree
+    template <typename Iterator, typename Tree>
+    static Iterator find_pending(Tree* tree, const key_type& key)
+    {
+        auto leaf = tree->leaf_of(key);
+        const Message* newest = tree->newest_message(leaf, key);
+        auto found = leaf->records.find(key);
+        if (newest != nullptr ? !newest->second : found == leaf->records.end())
+        {
+            return Iterator{ tree };
+        }
+
+        Iterator result{ tree, leaf, found };
+        if (found == leaf->records.end())
+        {
+            result.message = newest;
+        }
+        return result;
+    }
+
+    // lower (upper if strict) bound of key with the pending messages merged
+    template <typename Iterator, typename Tree>
+    static Iterator seek_pending(Tree* tree, const key_type& key, bool strict)
+    {
+        Iterator result{ tree, tree->leaf_of(key) };
+        result.seek(&key, strict, true);
+        return result;
+    }
+
+    // number of keys with the pending messages applied, O(pending * log n)
+    size_type resolved_size() const
+    {
+        // all messages, the older of equal keys first
+        std::vector<Message> messages;
+        messages.reserve(m_pending);
+        std::vector<const node_type*> layers;
+        for (const node_type* first = m_root; first != nullptr && !first->is_leaf; first = first->records.begin()->second)
+        {
+            layers.push_back(first);
+        }
+        for (auto iter = layers.rbegin(); iter != layers.rend(); iter++)
+        {
+            for (const node_type* node = *iter; node != nullptr; node = node->next)
+            {
+                messages.insert(messages.end(), buffer_of(node).begin(), buffer_of(node).end());
+            }
+        }
+        std::stable_sort(messages.begin(), messages.end(), [this](const Message& lhs, const Message& rhs)
+        {
+            return m_innercomp(lhs.first, rhs.first);
+        });
+
+        size_type size = m_size;
+        for (size_type i = 0; i < messages.size(); i++)
+        {
+            if (i + 1 < messages.size() && equal_key(messages[i].first, messages[i + 1].first))
+            {
+                continue;   // not the newest one
+            }
+            const node_type* leaf = leaf_of(messages[i].first);
+            const bool exists = leaf->records.find(messages[i].first) != leaf->records.end();
+            if (messages[i].second != exists)
+            {
+                messages[i].second ? size++ : size--;
+            }
+        }
+        return size;
+    }
+
+    // remove the messages of key from a buffer, return the newest one
+    Pending purge_buffer(node_type* node, const key_type& key)
+    {
+        std::vector<Message>& buffer = buffer_of(node);
+        Pending newest = Pending::NONE;
+        auto last = std::remove_if(buffer.begin(), buffer.end(), [&](const Message& message)
+        {
+            if (!equal_key(message.first, key))
+            {
+                return false;
+            }
+            newest = message.second ? Pending::INSERT : Pending::ERASE;
+            return true;
+        });
+        m_pending -= buffer.end() - last;
+        buffer.erase(last, buffer.end());
+        return newest;
+    }
+
+    // remove the messages of key on its path, return the newest one
+    Pending purge(const key_type& key)
+    {
+        Pending newest = Pending::NONE;
+        for (node_type* cur = m_root; m_pending != 0 && cur != nullptr && !cur->is_leaf; )
+        {
+            const Pending pending = purge_buffer(cur, key);
+            if (newest == Pending::NONE)
+            {
+                newest = pending;
+            }
+
+            auto find_result = cur->records.lower_bound(key);
+            if (find_result == cur->records.end())
+            {
+                break;
+            }
+            cur = find_result->second;
+        }
+        return newest;
+    }
+
+    // append a message to an inner node, a key beyond the last separator raises it; no leaf
+    // below holds the key then, but a stale separator above may have routed an older insert
+    // of it to this buffer, which an erase must still cancel
+    void push_message(node_type* node, const Message& message)
+    {
+        auto last = --node->records.end();
+        if (m_innercomp(last->first, message.first))
+        {
+            const_cast<key_type&>(last->first) = message.first;
+        }
+        buffer_of(node).push_back(message);
+        m_pending++;
+    }
+
+    // Push the messages of node one level down in key order, then flush the children
+    // holding more than threshold messages in the same way. The messages reaching the
+    // leaves are applied after all the buffers are distributed, so that no node changes
+    // during the distribution.
+    void flush_from(node_type* node, size_type threshold)
+    {
+        std::vector<Message> messages;
+        distribute(node, threshold, messages);
+
+        Extras& extras = own_extras();
+        extras.applying = &messages;
+        apply_messages(messages);
+        extras.applying = nullptr;
+    }
+
+    void distribute(node_type* node, size_type threshold, std::vector<Message>& to_leaves)
+    {
+        std::vector<Message> messages;
+        messages.swap(buffer_of(node));
+        m_pending -= messages.size();
+
+        // the later of equal keys stays later
+        std::stable_sort(messages.begin(), messages.end(), [this](const Message& lhs, const Message& rhs)
+        {
+            return m_innercomp(lhs.first, rhs.first);
+        });
+
+        if (node->records.begin()->second->is_leaf)
+        {
+            to_leaves.insert(to_leaves.end(), messages.begin(), messages.end());
+            return;
+        }
+
+        auto child = node->records.begin();
+        for (const Message& message : messages)
+        {
+            while (child != node->records.end() && m_innercomp(child->first, message.first))
+            {
+                child++;
+            }
+
+            if (child == node->records.end())
+            {
+                // only after the last child of node moved away, see move_buffer_up
+                const_cast<key_type&>((--child)->first) = message.first;
+            }
+            push_message(child->second, message);
+        }
+
+        for (auto iter = node->records.begin(), end = node->records.end(); iter != end; iter++)
+        {
+            if (!iter->second->is_leaf && (threshold == 0 || buffer_of(iter->second).size() > threshold))
+            {
+                distribute(iter->second, threshold, to_leaves);
+            }
+        }
+    }
+
+    // Apply messages to the leaves, in their order. The messages routed to one leaf are
+    // applied in a single pass: one descent finds the leaf and the range of keys routed to
+    // it, the records are inserted and erased in place, then an overflowed leaf is cut by
+    // the split machinery once. An erase which would rebalance the leaf goes through
+    // erase_key, and the next messages descend again.
+    void apply_messages(std::vector<Message>& messages)
+    {
+        // messages may grow while applying, see erase_record
+        for (size_type i = 0; i < messages.size(); )
+        {
+            if (m_root == nullptr)
+            {
+                const Message message = messages[i++];
+                if (message.second)
+                {
+                    insert_key(message.first);
+                }
+                continue;
+            }
+            i = apply_leaf_messages(messages, i);
+        }
+    }
+
+    // apply the messages from first on while they are routed to the same leaf, return the
+    // position of the next message
+    size_type apply_leaf_messages(std::vector<Message>& messages, size_type first)
+    {
+        // the keys routed to leaf are in (*lo, *hi], nullptr is unbounded
+        const key_type* lo = nullptr;
+        const key_type* hi = nullptr;
+        node_type* leaf = m_root;
+        while (!leaf->is_leaf)
+        {
+            auto child = leaf->records.lower_bound(messages[first].first);
+            if (child == leaf->records.end())
+            {
+                --child;
+            }
+            if (std::next(child) != leaf->records.end())
+            {
+                hi = &child->first;
+            }
+            if (child != leaf->records.begin())
+            {
+                lo = &std::prev(child)->first;
+            }
+            leaf = child->second;
+        }
+
+        bool changed = false, erased = false, rebalance = false;
+        size_type i = first;
+        for (; i < messages.size(); i++)
+        {
+            const Message& message = messages[i];
+            if ((lo != nullptr && !m_innercomp(*lo, message.first)) || (hi != nullptr && m_innercomp(*hi, message.first)))
+            {
+                break;
+            }
+
+            if (message.second)
+            {
+                if (leaf->records.insert(RecordPair(message.first, nullptr)).second)
+                {
+                    m_size++;
+                    filter_insert(message.first);
+                    changed = true;
+                }
+                continue;
+            }
+
+            auto found = leaf->records.find(message.first);
+            if (found == leaf->records.end())
+            {
+                continue;
+            }
+            if (!erases_directly(leaf))
+            {
+                rebalance = true;
+                break;
+            }
+            leaf->records.erase(found);
+            m_size--;
+            count_filter_changes(1u);
+            changed = erased = true;
+        }
+
+        if (changed)
+        {
+            if (erased)
+            {
+                bump_version(leaf);
+            }
+            settle_leaf(leaf);
+        }
+
+        if (rebalance)
+        {
+            const key_type key = messages[i].first;
+            erase_key(key);
+            return i + 1;
+        }
+        return i;
+    }
+
+    // whether a record can be erased from leaf without rebalancing, see erase_strategy
+    bool erases_directly(const node_type* leaf) const
+    {
+        if (m_size <= 1u)
+        {
+            return false;
+        }
+        if (leaf == m_root)
+        {
+            return true;
+        }
+        if (erase_policy() != ErasePolicy::EAGER)
+        {
+            return leaf->records.size() - 1 >= min_fill();
+        }
+        return order > 2 && leaf->records.size() > half_order;
+    }
+
+    // fix the separators above a leaf whose records were changed in place, then split it
+    // into even pieces of at most order records
+    void settle_leaf(node_type* leaf)
+    {
+        if (leaf != m_root)
+        {
+            // an insert beyond the separator raises it, an erase of the maximum lowers it
+            // when the separators are exact
+            auto entry = entry_in_parent(leaf);
+            const key_type& last = (--leaf->records.end())->first;
+            if (m_innercomp(entry->first, last))
+            {
+                raise_key_on_path(leaf, last);
+            }
+            else if (exact_separators() && m_innercomp(last, entry->first))
+            {
+                fix_key_on_path(leaf, last);
+            }
+        }
+
+        update_aggregate_path(leaf);
+        for (size_type remaining = leaf->records.size(); remaining > order; )
+        {
+            const size_type count = remaining / ((remaining + order - 1) / order);
+            auto split_result = split(leaf, count);
+            for (node_type* cur = split_result.first; cur != nullptr && cur->records.size() > order; )
+            {
+                cur = split(cur, split_count(false)).first;
+            }
+            update_aggregate_path(split_result.second);
+            update_aggregate_path(leaf);
+            remaining -= count;
+        }
+    }
+
+    // all pending messages, the older of equal keys first
+    std::vector<Message> take_all_messages()
+    {
+        std::vector<std::vector<Message>> layers;
+        for (node_type* first = m_root; m_pending != 0 && first != nullptr && !first->is_leaf;
+             first = first->records.begin()->second)
+        {
+            layers.emplace_back();
+            for (node_type* node = first; node != nullptr; node = node->next)
+            {
+                std::vector<Message>& buffer = buffer_of(node);
+                layers.back().insert(layers.back().end(), buffer.begin(), buffer.end());
+                buffer.clear();
+            }
+        }
+        m_pending = 0u;
+
+        std::vector<Message> messages;
+        for (auto iter = layers.rbegin(); iter != layers.rend(); iter++)
+        {
+            messages.insert(messages.end(), iter->begin(), iter->end());
+        }
+        return messages;
+    }
+
+    // move the messages of node with keys not greater than (greater than) key to dst, the
+    // nodes are in the same layer
+    void move_buffer(node_type* node, node_type* dst, const key_type& key, bool not_greater)
+    {
+        if (node->is_leaf)
+        {
+            return;
+        }
+
+        std::vector<Message>& buffer = buffer_of(node);
+        auto middle = std::stable_partition(buffer.begin(), buffer.end(), [&](const Message& message)
+        {
+            return m_innercomp(key, message.first) == not_greater;
+        });
+        buffer_of(dst).insert(buffer_of(dst).end(), middle, buffer.end());
+        buffer.erase(middle, buffer.end());
+    }
+
+    // the messages of a removed node go to its parent, before the newer ones there
+    void move_buffer_up(node_type* node)
+    {
+        if (!node->is_leaf && !buffer_of(node).empty())
+        {
+            std::vector<Message>& buffer = buffer_of(node);
+            buffer_of(node->parent).insert(buffer_of(node->parent).begin(), buffer.begin(), buffer.end());
+            buffer.clear();
+        }
+    }
+
+    // give a leaf the next version of the tree, which no leaf of it had before; without
+    // the optional state there is no cache to check the versions
+    void bump_version(node_type* node)
+    {
+        if (node != nullptr && node->is_leaf && m_extras != nullptr)
+        {
+            static_cast<LeafNode*>(node)->version = ++m_extras->version_clock;
+        }
+    }
+
+    // forget the entries of a leaf about to be freed, only leaves that had one are scanned for
+    void drop_cache_entries(node_type* leaf)
+    {
+        if (!static_cast<LeafNode*>(leaf)->cached)
+        {
+            return;
+        }
+        for (CacheEntry& entry : m_extras->cache)
+        {
+            if (entry.node == leaf)
+            {
+                entry.node = nullptr;
+            }
+        }
+    }
+
+    static std::size_t version_of(const node_type* leaf)
+    {
+        assert(leaf->is_leaf);
+        return static_cast<const LeafNode*>(leaf)->version;
+    }
+
+    static std::vector<Message>& buffer_of(node_type* node)
+    {
+        assert(!node->is_leaf);
+        return static_cast<InnerNode*>(node)->buffer;
+    }
+
+    static const std::vector<Message>& buffer_of(const node_type* node)
+    {
+        assert(!node->is_leaf);
+        return static_cast<const InnerNode*>(node)->buffer;
+    }
+
+    // --------------- lookup helpers ---------------
+
+    iterator find_in_tree(const key_type& key)
+    {
+        if (learned_index() != 0)
+        {
+            node_type* leaf = learned_leaf(key, false);
+            if (leaf != nullptr)
+            {
+                auto find_result = leaf->records.find(key);
+                return find_result != leaf->records.end() ? make_iterator_uncheck(leaf, find_result) : make_iterator();
+            }
+        }
+
+        auto cur = m_root;
+        while (cur != nullptr)
+        {
+            if (!cur->is_leaf)
+            {
+                auto find_result = cur->records.lower_bound(key);
+                if (find_result == cur->records.end())
+                {
+                    return make_iterator();
+                }
+                cur = find_result->second;
+            }
+            else
+            {
+                auto find_result = cur->records.find(key);
+                if (find_result != cur->records.end())
+                {
+                    return make_iterator_uncheck(cur, find_result);
+                }
+                else
+                {
+                    return make_iterator();
+                }
+            }
+        }
+        return make_iterator();
+    }
+
+    bool cache_hit(const CacheEntry& entry, const key_type& key) const
+    {
+        return entry.node != nullptr && entry.epoch == m_extras->cache_epoch && entry.version == version_of(entry.node)
+            && equal_key(entry.record->first, key);
+    }
+
+    // --------------- bloom filter helpers ---------------
+
+    // called once key is in its leaf, which may be overfull yet
+    void filter_insert(const key_type& key)
+    {
+        if (m_extras == nullptr)
+        {
+            return;
+        }
+        if (!m_extras->filter.empty())
+        {
+            m_extras->filter.insert(key);
+        }
+        m_extras->filter_changes++;
+        refresh_filter();
+    }
+
+    void count_filter_changes(size_type changes)
+    {
+        if (m_extras != nullptr)
+        {
+            m_extras->filter_changes += changes;
+        }
+    }
+
+    // rebuild a missing or stale filter, only the writers call it
+    void refresh_filter()
+    {
+        if (bloom_filter() != 0 && (m_extras->filter.empty() || m_extras->filter_changes * 2 > m_extras->filter.capacity()))
+        {
+            rebuild_filter();
+        }
+    }
+
+    // whether the filter proves key absent, read only: the filter holds every key in the
+    // leaves, a stale one only rejects less
+    bool filter_rejects(const key_type& key) const
+    {
+        return m_extras != nullptr && !m_extras->filter.empty() && !m_extras->filter.may_contain(key);
+    }
+
+    void rebuild_filter()
+    {
+        m_extras->filter = BlockedBloomFilter<key_type, KeyHash>(std::max(m_size, size_type(64u)), m_extras->filter_bits);
+        for (auto leaf = first_leaf(); leaf != &m_header; leaf = leaf->next)
+        {
+            for (auto iter = leaf->records.begin(), end = leaf->records.end(); iter != end; iter++)
+            {
+                m_extras->filter.insert(iter->first);
+            }
+        }
+        m_extras->filter_changes = 0u;
+    }
+
+    // --------------- learned index helpers ---------------
+
+    void reset_learned_index()
+    {
+        if (m_extras == nullptr)
+        {
+            return;
+        }
+        m_extras->learned_valid = false;
+        m_extras->learned_lookups = 0u;
+        m_extras->learned_splits = 0u;
+        m_extras->learned_leaves.clear();
+        m_extras->learned_keys.clear();
+        m_extras->learned_segments.clear();
+    }
+
+    void build_learned_index(std::false_type)
+    {
+    }
+
+    // fit segments with the shrinking cone: a segment grows while some slope keeps all of
+    // its leaves within epsilon, [slope_lo, slope_hi] are the slopes left
+    void build_learned_index(std::true_type)
+    {
+        reset_learned_index();
+        if (learned_index() == 0)
+        {
+            return;
+        }
+
+        for (node_type* leaf = first_leaf(); leaf != &m_header; leaf = leaf->next)
+        {
+            if (!leaf->records.empty())
+            {
+                m_extras->learned_leaves.push_back(leaf);
+                m_extras->learned_keys.push_back(leaf->records.begin()->first);
+            }
+        }
+
+        const double epsilon = double(m_extras->learned_epsilon);
+        size_type start = 0u;
+        double slope_lo = 0.0, slope_hi = std::numeric_limits<double>::infinity();
+        for (size_type i = 1; i <= m_extras->learned_keys.size(); i++)
+        {
+            if (i < m_extras->learned_keys.size())
+            {
+                const double dx = double(m_extras->learned_keys[i]) - double(m_extras->learned_keys[start]);
+                const double dy = double(i - start);
+                if (dx > 0.0)
+                {
+                    const double lo = std::max(slope_lo, (dy - epsilon) / dx);
+                    const double hi = std::min(slope_hi, (dy + epsilon) / dx);
+                    if (lo <= hi)
+                    {
+                        slope_lo = lo;
+                        slope_hi = hi;
+                        continue;
+                    }
+                }
+                else if (dy <= epsilon)
+                {
+                    continue;
+                }
+            }
+
+            const double slope = slope_hi == std::numeric_limits<double>::infinity() ? slope_lo : (slope_lo + slope_hi) / 2;
+            m_extras->learned_segments.push_back(LearnedSegment{ m_extras->learned_keys[start], slope, start });
+            start = i;
+            slope_lo = 0.0;
+            slope_hi = std::numeric_limits<double>::infinity();
+        }
+        m_extras->learned_valid = true;
+    }
+
+    // the non-const lookups refit an invalid model after as many of them as its snapshot
+    // had leaves
+    node_type* learned_leaf(const key_type& key, bool upper)
+    {
+        if (m_extras != nullptr && !m_extras->learned_valid && m_root != nullptr && ++m_extras->learned_lookups > std::max(m_extras->learned_leaves.size(), size_type(64u)))
+        {
+            build_learned_index(std::is_arithmetic<key_type>());
+        }
+        return const_cast<node_type*>(static_cast<const BPlusTree*>(this)->learned_leaf(key, upper));
+    }
+
+    const node_type* learned_leaf(const key_type& key, bool upper) const
+    {
+        return learned_index() == 0 ? nullptr : learned_leaf(key, upper, std::is_arithmetic<key_type>());
+    }
+
+    const node_type* learned_leaf(const key_type&, bool, std::false_type) const
+    {
+        return nullptr;
+    }
+
+    // the leaf holding the lower (upper) bound of key, nullptr if the model is invalid;
+    // read only
+    const node_type* learned_leaf(const key_type& key, bool upper, std::true_type) const
+    {
+        if (!m_extras->learned_valid || m_extras->learned_leaves.empty())
+        {
+            return nullptr;
+        }
+
+        // predict with the last segment starting at or before key
+        auto segment = std::upper_bound(m_extras->learned_segments.begin(), m_extras->learned_segments.end(), key,
+            [this](const key_type& lhs, const LearnedSegment& rhs) { return m_innercomp(lhs, rhs.first); });
+        if (segment != m_extras->learned_segments.begin())
+        {
+            --segment;
+        }
+        // a key in the gap after the last leaf of a segment must not be extrapolated
+        const double last = double(std::next(segment) == m_extras->learned_segments.end() ?
+            m_extras->learned_keys.size() - 1 : std::next(segment)->start - 1);
+        const double predicted = std::max(double(segment->start), std::min(last,
+            double(segment->start) + segment->slope * (double(key) - double(segment->first))));
+
+        // the last first key not greater than key, within the error bound
+        const size_type center = size_type(predicted);
+        const size_type lo = center > m_extras->learned_epsilon ? center - m_extras->learned_epsilon - 1 : 0u;
+        const size_type hi = std::min(center + m_extras->learned_epsilon + 2, m_extras->learned_keys.size());
+        auto position = std::upper_bound(m_extras->learned_keys.begin() + lo, m_extras->learned_keys.begin() + hi, key,
+            [this](const key_type& lhs, const key_type& rhs) { return m_innercomp(lhs, rhs); });
+        node_type* leaf = m_extras->learned_leaves[position == m_extras->learned_keys.begin() ? 0 : position - m_extras->learned_keys.begin() - 1];
+
+        // leaves split or keys inserted since the snapshot, go to the first leaf whose
+        // maximum is not less than (greater than) key
+        auto before = [&](const node_type* node)
+        {
+            return upper ? !m_innercomp(key, max_key_of(node)) : m_innercomp(max_key_of(node), key);
+        };
+        while (leaf->pre != &m_header && !before(leaf->pre))
+        {
+            leaf = leaf->pre;
+        }
+        while (leaf->next != &m_header && before(leaf))
+        {
+            leaf = leaf->next;
+        }
+        return leaf;
+    }
+
+    // unlink the first and last leaves from the header, before cutting the tree into pieces
+    void detach_leaf_ends()
+    {
+        m_header.next->pre = nullptr;
+        m_header.pre->next = nullptr;
+        reset_header();
+        if (m_extras != nullptr)
+        {
+            m_extras->compact_cursor = nullptr;
+            m_extras->learned_valid = false;
+        }
+    }
+
+    // make a piece the whole tree, which must be empty
+    void adopt(const Piece& piece, size_type size)
+    {
+        assert(m_root == nullptr);
+
+        clear();
+        if (piece.root == nullptr)
+        {
+            return;
+        }
+
+        set_root(piece.root);
+        m_root->parent = nullptr;
+        m_size = size;
+
+        for (node_type* node = m_root; ; node = node->records.begin()->second)
+        {
+            node->pre = node->is_leaf ? &m_header : nullptr;
+            if (node->is_leaf)
+            {
+                m_header.next = node;
+                break;
+            }
+        }
+        for (node_type* node = m_root; ; node = node->records.rbegin()->second)
+        {
+            node->next = node->is_leaf ? &m_header : nullptr;
+            if (node->is_leaf)
+            {
+                m_header.pre = node;
+                break;
+            }
+        }
+    }
+
+    // detach node as a piece, drop it if it's empty and shrink it while it has a single child
+    Piece make_piece(node_type* node, size_type height)
+    {
+        // the layer is cut around a dropped node
+        auto unlink = [](node_type* node)
+        {
+            if (node->pre != nullptr)
+            {
+                node->pre->next = nullptr;
+            }
+            if (node->next != nullptr)
+            {
+                node->next->pre = nullptr;
+            }
+        };
+
+        node->parent = nullptr;
+        if (node->records.empty())
+        {
+            unlink(node);
+            free_node(node);
+            return Piece();
+        }
+
+        while (!node->is_leaf && node->records.size() == 1)
+        {
+            node_type* child = node->records.begin()->second;
+            unlink(node);
+            free_node(node);
+            node = child;
+            node->parent = nullptr;
+            height--;
+        }
+        return Piece{ node, height };
+    }
+
+    // move the first count records of right to the end of left
+    void shift_to_left(node_type* left, node_type* right, size_type count)
+    {
+        for (; count > 0; count--)
+        {
+            auto iter = right->records.begin();
+            if (iter->second != nullptr)
+            {
+                iter->second->parent = left;
+            }
+            left->records.insert(left->records.end(), std::move(*iter));
+            right->records.erase(iter);
+        }
+    }
+
+    // move the last count records of left to the front of right
+    void shift_to_right(node_type* left, node_type* right, size_type count)
+    {
+        for (; count > 0; count--)
+        {
+            auto iter = --left->records.end();
+            if (iter->second != nullptr)
+            {
+                iter->second->parent = right;
+            }
+            right->records.insert(right->records.begin(), std::move(*iter));
+            left->records.erase(iter);
+        }
+    }
+
+    // Join two pieces, the keys in right are greater than the ones in left. The shorter
+    // piece is linked into the border path of the higher one, then it borrows from or is
+    // merged with its sibling if it's underfull, and the overflowed nodes are split.
+    Piece join_pieces(Piece left, Piece right)
+    {
+        if (left.root == nullptr)
+        {
+            return right;
+        }
+        if (right.root == nullptr)
+        {
+            return left;
+        }
+
+        // link the layers along the border
+        {
+            node_type* l = left.root;
+            node_type* r = right.root;
+            for (size_type h = left.height; h > right.height; h--)
+            {
+                l = l->records.rbegin()->second;
+            }
+            for (size_type h = right.height; h > left.height; h--)
+            {
+                r = r->records.begin()->second;
+            }
+            while (true)
+            {
+                l->next = r;
+                r->pre = l;
+                if (l->is_leaf)
+                {
+                    break;
+                }
+                l = l->records.rbegin()->second;
+                r = r->records.begin()->second;
+            }
+        }
+
+        if (left.height == right.height)
+        {
+            node_type* l = left.root;
+            node_type* r = right.root;
+            if (l->records.size() + r->records.size() <= order)
+            {
+                shift_to_left(l, r, r->records.size());
+                l->next = r->next;
+                if (r->next != nullptr)
+                {
+                    r->next->pre = l;
+                }
+                free_node(r);
+                update_aggregate(l);
+                return left;
+            }
+
+            if (l->records.size() < half_order)
+            {
+                shift_to_left(l, r, half_order - l->records.size());
+            }
+            if (r->records.size() < half_order)
+            {
+                shift_to_right(l, r, half_order - r->records.size());
+            }
+            update_aggregate(l);
+            update_aggregate(r);
+
+            node_type* root = make_node(false);
+            root->records.insert(root->records.end(), std::make_pair(max_key_of(l), l));
+            root->records.insert(root->records.end(), std::make_pair(max_key_of(r), r));
+            l->parent = r->parent = root;
+            update_aggregate(root);
+            return Piece{ root, left.height + 1 };
+        }
+
+        node_type* parent = nullptr;
+        if (left.height > right.height)
+        {
+            node_type* node = right.root;
+            parent = left.root;
+            for (size_type h = left.height; h > right.height + 1; h--)
+            {
+                parent = parent->records.rbegin()->second;
+            }
+
+            parent->records.insert(parent->records.end(), std::make_pair(max_key_of(node), node));
+            node->parent = parent;
+            for (node_type* cur = parent; cur->parent != nullptr; cur = cur->parent)
+            {
+                const_cast<key_type&>(cur->parent->records.rbegin()->first) = max_key_of(node);
+            }
+
+            if (node->records.size() < half_order)
+            {
+                node_type* sibling = node->pre;
+                auto sibling_in_parent = std::prev(parent->records.end(), 2);
+                if (sibling->records.size() + node->records.size() <= order)
+                {
+                    shift_to_right(sibling, node, sibling->records.size());
+                    node->pre = sibling->pre;
+                    if (sibling->pre != nullptr)
+                    {
+                        sibling->pre->next = node;
+                    }
+                    parent->records.erase(sibling_in_parent);
+                    free_node(sibling);
+                }
+                else
+                {
+                    shift_to_right(sibling, node, half_order - node->records.size());
+                    const_cast<key_type&>(sibling_in_parent->first) = max_key_of(sibling);
+                    update_aggregate(sibling);
+                }
+                update_aggregate(node);
+            }
+        }
+        else
+        {
+            node_type* node = left.root;
+            parent = right.root;
+            for (size_type h = right.height; h > left.height + 1; h--)
+            {
+                parent = parent->records.begin()->second;
+            }
+
+            parent->records.insert(parent->records.begin(), std::make_pair(max_key_of(node), node));
+            node->parent = parent;
+
+            if (node->records.size() < half_order)
+            {
+                node_type* sibling = node->next;
+                auto node_in_parent = parent->records.begin();
+                if (sibling->records.size() + node->records.size() <= order)
+                {
+                    shift_to_right(node, sibling, node->records.size());
+                    sibling->pre = node->pre;
+                    if (node->pre != nullptr)
+                    {
+                        node->pre->next = sibling;
+                    }
+                    parent->records.erase(node_in_parent);
+                    free_node(node);
+                }
+                else
+                {
+                    shift_to_left(node, sibling, half_order - node->records.size());
+                    const_cast<key_type&>(node_in_parent->first) = max_key_of(node);
+                    update_aggregate(node);
+                }
+                update_aggregate(sibling);
+            }
+        }
+
+        const size_type height = std::max(left.height, right.height);
+        node_type* root = left.height > right.height ? left.root : right.root;
+
+        while (parent->records.size() > order)
+        {
+            parent = split(parent).first;
+        }
+        update_aggregate_path(parent);
+
+        if (root->parent != nullptr)
+        {
+            return Piece{ root->parent, height + 1 };
+        }
+        return Piece{ root, height };
     }
 
-    const_iterator end() const
+    // build the inner layers over a layer of linked nodes, return the root
+    node_type* build_inner_layers(std::vector<node_type*>& nodes)
     {
-        return make_iterator();
-    }
+        while (nodes.size() > 1)
+        {
+            const size_type parent_count = (nodes.size() + order - 1) / order;
+            std::vector<node_type*> parents;
+            parents.reserve(parent_count);
 
-    const_iterator cbegin() const
-    {
-        return begin();
-    }
+            auto child = nodes.begin();
+            for (size_type i = 0; i < parent_count; i++)
+            {
+                // spread the children evenly
+                size_type child_count = nodes.size() / parent_count + (i < nodes.size() % parent_count ? 1 : 0);
+                node_type* parent = make_node(false);
+                parent->pre = parents.empty() ? nullptr : parents.back();
+                if (!parents.empty())
+                {
+                    parents.back()->next = parent;
+                }
 
-    const_iterator cend() const
-    {
-        return end();
-    }
+                for (; child_count > 0; child_count--, child++)
+                {
+                    parent->records.insert(parent->records.end(), std::make_pair((--(*child)->records.end())->first, *child));
+                    (*child)->parent = parent;
+                }
+                update_aggregate(parent);
+                parents.push_back(parent);
+            }
 
-    // --------------- const version ---------------
+            nodes.swap(parents);
+        }
 
-    const_iterator find(const key_type& key) const
-    {
-        return const_iterator(const_cast<BPlusTree*>(this)->find(key));
+        return nodes.front();
     }
 
-    const_iterator lower_bound(const key_type& key) const
+    // Descend n lookups together, all leaves are in the same layer. The leaf which may
+    // hold keys[i] is written to nodes[i], or nullptr if keys[i] is greater than all keys.
+    void find_leaves_batch(const key_type* const* keys, node_type** nodes, size_type n) const
     {
-        return const_iterator(const_cast<BPlusTree*>(this)->lower_bound(key));
-    }
+        for (size_type i = 0; i < n; i++)
+        {
+            nodes[i] = m_root;
+        }
 
-    const_iterator upper_bound(const key_type& key) const
-    {
-        return const_iterator(const_cast<BPlusTree*>(this)->upper_bound(key));
-    }
+        for (bool descended = m_root != nullptr; descended; )
+        {
+            descended = false;
+            for (size_type i = 0; i < n; i++)
+            {
+                if (nodes[i] == nullptr)
+                {
+                    continue;
+                }
+                if (nodes[i]->is_leaf)
+                {
+                    return;
+                }
 
-    std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const
-    {
-        return const_iterator(const_cast<BPlusTree*>(this)->equal_range(key));
+                auto find_result = nodes[i]->records.lower_bound(*keys[i]);
+                if (find_result == nodes[i]->records.end())
+                {
+                    nodes[i] = nullptr;
+                }
+                else
+                {
+                    nodes[i] = find_result->second;
+                    BPLUSTREE_PREFETCH(nodes[i]);
+                    descended = true;
+                }
+            }
+        }
     }
 
-    // ------------------------------------------------
-    size_type size() const
+    // lo_covered/hi_covered: all keys in the subtree are not less than lo / not greater than hi
+    void query_helper(const node_type* node, const key_type& lo, const key_type& hi,
+                      bool lo_covered, bool hi_covered, aggregate_type& result) const
     {
-        return m_size;
-    }
+        if (lo_covered && hi_covered)
+        {
+            result = Aggregate::combine(result, node->aggregate);
+            return;
+        }
 
-    bool empty() const
-    {
-        return m_size == 0;
-    }
+        if (node->is_leaf)
+        {
+            auto iter = lo_covered ? node->records.begin() : node->records.lower_bound(lo);
+            for (auto end = node->records.end(); iter != end && !m_innercomp(hi, iter->first); iter++)
+            {
+                result = Aggregate::combine(result, Aggregate::lift(iter->first));
+            }
+            return;
+        }
 
-    void clear()
-    {
-        clear_helper(m_root);
-        m_root = nullptr;
-        reset_header();
-        m_size = 0u;
+        auto iter = lo_covered ? node->records.begin() : node->records.lower_bound(lo);
+        const key_type* pre_key = iter == node->records.begin() ? nullptr : &std::prev(iter)->first;
+        for (auto end = node->records.end(); iter != end; pre_key = &iter->first, iter++)
+        {
+            // the keys of the child are in (pre_key, iter->first]
+            if (pre_key != nullptr && !m_innercomp(*pre_key, hi))
+            {
+                break;
+            }
+            query_helper(iter->second, lo, hi,
+                         lo_covered || (pre_key != nullptr && !m_innercomp(*pre_key, lo)),
+                         hi_covered || !m_innercomp(hi, iter->first),
+                         result);
+        }
     }
 
-    void print() const
+    // combine the keys in (after, upto] of the subtree, nullptr is unbounded;
+    // after_covered/upto_covered: all keys in the subtree are in the bound
+    void range_helper(const node_type* node, const key_type* after, const key_type* upto,
+                      bool after_covered, bool upto_covered, aggregate_type& result) const
     {
-        if (m_root == nullptr)
+        if (after_covered && upto_covered)
         {
+            result = Aggregate::combine(result, node->aggregate);
             return;
         }
 
-        std::queue<node_type*> q;
-        q.push(m_root);
-
-        while (!q.empty())
+        if (node->is_leaf)
         {
-            auto cur = q.front();
-            q.pop();
-
-            std::cout << "[";
-            auto iter = cur->records.begin(), end = cur->records.end();
-            for (int i = 0; i < cur->records.size() - 1; i++)
-            {
-                std::cout << iter->first << ",";
-                if (iter->second != nullptr)
-                {
-                    q.push(iter->second);
-                }
-                iter++;
-            }
-            std::cout << iter->first << "]";
-            if (iter->second != nullptr)
+            auto iter = after_covered ? node->records.begin() : node->records.upper_bound(*after);
+            for (auto end = node->records.end(); iter != end && (upto_covered || !m_innercomp(*upto, iter->first)); iter++)
             {
-                q.push(iter->second);
+                result = Aggregate::combine(result, Aggregate::lift(iter->first));
             }
-            if (cur->next == nullptr || cur->next == &m_header)
+            return;
+        }
+
+        auto iter = after_covered ? node->records.begin() : node->records.lower_bound(*after);
+        const key_type* pre_key = iter == node->records.begin() ? nullptr : &std::prev(iter)->first;
+        for (auto end = node->records.end(); iter != end; pre_key = &iter->first, iter++)
+        {
+            // the keys of the child are in (pre_key, iter->first]
+            if (!upto_covered && pre_key != nullptr && !m_innercomp(*pre_key, *upto))
             {
-                std::cout << "\n";
+                break;
             }
+            range_helper(iter->second, after, upto,
+                         after_covered || (pre_key != nullptr && !m_innercomp(*pre_key, *after)),
+                         upto_covered || !m_innercomp(*upto, iter->first),
+                         result);
         }
     }
 
-private:
-    void clear_helper(node_type* node)
+    aggregate_type range_aggregate(const key_type* after, const key_type* upto) const
     {
-        if (node == nullptr)
+        aggregate_type result = Aggregate::identity();
+        if (m_root != nullptr)
+        {
+            range_helper(m_root, after, upto, after == nullptr, upto == nullptr, result);
+        }
+        return result;
+    }
+
+    // node holds all keys of this tree in (after, upto], compare them with the ones of other
+    template <typename OutputIt>
+    void diff_helper(const node_type* node, const key_type* after, const key_type* upto,
+                     const BPlusTree& other, OutputIt& out) const
+    {
+        if (node->aggregate == other.range_aggregate(after, upto))
         {
             return;
         }
 
-        for (auto iter = node->records.begin(), end = node->records.end(); iter != end; iter++)
+        if (node->is_leaf)
         {
-            clear_helper(iter->second);
+            auto iter = node->records.begin(), end = node->records.end();
+            auto ano = after == nullptr ? other.begin() : other.upper_bound(*after), ano_end = other.end();
+            auto in_range = [&](const const_iterator& pos)
+            {
+                return pos != ano_end && (upto == nullptr || !m_innercomp(*upto, *pos));
+            };
+
+            while (iter != end || in_range(ano))
+            {
+                if (!in_range(ano) || (iter != end && m_innercomp(iter->first, *ano)))
+                {
+                    *out++ = std::make_pair(iter->first, true);
+                    iter++;
+                }
+                else if (iter == end || m_innercomp(*ano, iter->first))
+                {
+                    *out++ = std::make_pair(*ano, false);
+                    ano++;
+                }
+                else
+                {
+                    iter++;
+                    ano++;
+                }
+            }
+            return;
         }
 
-        delete node;
+        // the children split (after, upto] at the separators, the last one takes the rest
+        const key_type* child_after = after;
+        for (auto iter = node->records.begin(), end = node->records.end(); iter != end; iter++)
+        {
+            const key_type* child_upto = std::next(iter) == end ? upto : &iter->first;
+            diff_helper(iter->second, child_after, child_upto, other, out);
+            child_after = &iter->first;
+        }
     }
 
-    void reset_header()
+protected:
+    node_type* make_node(bool is_leaf)
     {
-        m_header.next = m_header.pre = &m_header;
+        if (is_leaf)
+        {
+            node_type* leaf = new LeafNode(m_innercomp);
+            bump_version(leaf);
+            return leaf;
+        }
+        return new InnerNode(m_innercomp);
     }
 
-protected:
-    node_type* make_node()
+    void free_node(node_type* node)
     {
-        return new node_type(m_innercomp);;
+        if (m_extras != nullptr)
+        {
+            if (node == m_extras->compact_cursor)
+            {
+                m_extras->compact_cursor = nullptr;
+            }
+            if (node->is_leaf)
+            {
+                m_extras->learned_valid = false;
+                drop_cache_entries(node);
+            }
+        }
+        if (node->is_leaf)
+        {
+            delete static_cast<LeafNode*>(node);
+        }
+        else
+        {
+            delete static_cast<InnerNode*>(node);
+        }
     }
 
     iterator make_iterator(node_type* node, const RecordIterator& rit)
@@ -685,14 +4217,88 @@ protected:
         return const_iterator{ this };
     }
 
+    // recompute the cached aggregate of node from its records or children
+    void update_aggregate(node_type* node)
+    {
+        update_aggregate(node, std::integral_constant<bool, Aggregate::enabled>());
+    }
+
+    void update_aggregate(node_type*, std::false_type)
+    {
+    }
+
+    void update_aggregate(node_type* node, std::true_type)
+    {
+        aggregate_type value = Aggregate::identity();
+        for (auto iter = node->records.begin(), end = node->records.end(); iter != end; iter++)
+        {
+            value = Aggregate::combine(value, node->is_leaf ? Aggregate::lift(iter->first) : iter->second->aggregate);
+        }
+        node->aggregate = value;
+    }
+
+    // recompute the cached aggregates from node up to the root
+    void update_aggregate_path(node_type* node)
+    {
+        if (!Aggregate::enabled)
+        {
+            return;
+        }
+
+        for (; node != nullptr; node = node->parent)
+        {
+            update_aggregate(node);
+        }
+    }
+
+    // count the inserts landing on the same end of a leaf in a row
+    void track_insert_position(const node_type* leaf, RecordIterator record_iterator)
+    {
+        if (record_iterator == --leaf->records.end())
+        {
+            m_extras->append_run++;
+            m_extras->prepend_run = 0u;
+        }
+        else if (record_iterator == leaf->records.begin())
+        {
+            m_extras->prepend_run++;
+            m_extras->append_run = 0u;
+        }
+        else
+        {
+            m_extras->append_run = m_extras->prepend_run = 0u;
+        }
+    }
+
+    // number of records moved to the new left node when an overflowed node is split
+    size_type split_count(bool is_leaf) const
+    {
+        if (split_policy() == SplitPolicy::EVEN || (m_extras->append_run < 2u && m_extras->prepend_run < 2u))
+        {
+            return half_order;
+        }
+
+        // a leaf keeps at least one record on both sides, an inner node keeps half_order
+        const size_type max_count = is_leaf ? order : order + 1 - half_order;
+        size_type skewed = static_cast<size_type>(m_extras->split_skew * (order + 1) + 0.5);
+        skewed = std::max(std::min(skewed, max_count), half_order);
+        return m_extras->append_run >= 2u ? skewed : order + 1 - skewed;
+    }
+
+    std::pair<node_type*, node_type*> split(node_type* node)
+    {
+        return split(node, half_order);
+    }
+
     // Return: inserted parent, new leaf node
-    std::pair<node_type*, node_type*> split(node_type* leaf_node)
+    std::pair<node_type*, node_type*> split(node_type* leaf_node, size_type left_count)
     {
         // split to left one 
-        node_type* left = make_node();
+        node_type* left = make_node(leaf_node->is_leaf);
+        bump_version(leaf_node);
 
         auto iter = leaf_node->records.begin(), end = leaf_node->records.end();
-        for (size_type i = 0; i < half_order; i++)
+        for (size_type i = 0; i < left_count; i++)
         {
             if (iter->second != nullptr)
             {
@@ -703,7 +4309,7 @@ protected:
         }
         key_type key = iter->first;
 
-        left->is_leaf = leaf_node->is_leaf;
+        move_buffer(leaf_node, left, (--left->records.end())->first, true);
 
         left->next = leaf_node;
         if (leaf_node->pre != nullptr)
@@ -717,8 +4323,7 @@ protected:
         if (parent == nullptr) // root
         {
             // root node has at least two key
-            parent = make_node();
-            parent->is_leaf = false;
+            parent = make_node(false);
             m_root = parent;
 
             parent->records.insert(parent->records.end(), std::make_pair((--leaf_node->records.end())->first, leaf_node));
@@ -728,12 +4333,23 @@ protected:
 
         leaf_node->parent = left->parent = parent;
 
+        update_aggregate(left);
+        update_aggregate(leaf_node);
+
+        // the snapshot of the learned index misses the new leaf, the walk finds it
+        if (left->is_leaf && m_extras != nullptr && m_extras->learned_valid && ++m_extras->learned_splits > m_extras->learned_leaves.size() / 4u)
+        {
+            m_extras->learned_valid = false;
+        }
+
         return { parent, left };
     }
 
     std::pair<node_type*, node_type*> merge_leaf(node_type* leaf_node, bool& propagation)
     {
         auto left = leaf_node->pre, right = leaf_node->next;
+        bump_version(left);
+        bump_version(right);
 
         // check left first
         if (left->parent == leaf_node->parent)
@@ -752,9 +4368,10 @@ protected:
             left->next = leaf_node->next;
             leaf_node->next->pre = left;
 
-            delete leaf_node;
+            free_node(leaf_node);
 
             left->parent->records.erase(splitter_iter);
+            update_aggregate(left);
 
             return std::make_pair(left->parent, left);
         }
@@ -771,36 +4388,58 @@ protected:
             leaf_node->next = right->next;
             right->next->pre = leaf_node;
 
-            delete right;
+            free_node(right);
 
             leaf_node->parent->records.erase(splitter_iter);
+            update_aggregate(leaf_node);
 
             return std::make_pair(leaf_node->parent, leaf_node);
         }
     }
 
-    void fix_key_on_path(node_type* node, const key_type& old_key, const key_type& new_key)
+    // the maximum of node is changed to new_key, fix the keys of node and its ancestors while
+    // they are the last child
+    void fix_key_on_path(node_type* node, const key_type& new_key)
     {
-        if (node->next == nullptr || node->next == &m_header)
+        if (node->parent == nullptr)
+        {
+            return;
+        }
+
+        // find the entry of the parent before changing the key, which may be its first one
+        for (auto node_in_parent = entry_in_parent(node); ; )
         {
-            node = node->parent;
-            while (node != nullptr)
+            node_type* parent = node->parent;
+            const bool is_last = node_in_parent == --parent->records.end() && parent->parent != nullptr;
+            auto parent_in_grand = is_last ? entry_in_parent(parent) : node_in_parent;
+
+            const_cast<key_type&>(node_in_parent->first) = new_key;
+            if (!is_last)
             {
-                const_cast<key_type&>((--node->records.end())->first) = new_key;
-                node = node->parent;
+                break;
             }
+
+            node = parent;
+            node_in_parent = parent_in_grand;
         }
-        else
+    }
+
+    // raise the separators on the path of node which are less than new_key; a stale greater
+    // one above may route pending messages down, so it's kept
+    void raise_key_on_path(node_type* node, const key_type& new_key)
+    {
+        for (; node->parent != nullptr; node = node->parent)
         {
-            node_type* right = node->next->parent;
-            node = node->parent;
-            while (node != right)
+            auto node_in_parent = entry_in_parent(node);
+            if (!m_innercomp(node_in_parent->first, new_key))
+            {
+                break;
+            }
+            const_cast<key_type&>(node_in_parent->first) = new_key;
+            if (node_in_parent != --node->parent->records.end())
             {
-                const_cast<key_type&>((--node->records.end())->first) = new_key;
-                node = node->parent;
-                right = right->parent;
+                break;
             }
-            const_cast<key_type&>(node->records.find(old_key)->first) = new_key;
         }
     }
 
@@ -809,6 +4448,44 @@ protected:
         ROOT, REMOVE_DIRECTLY, MERGE_LEFT, MERGE_RIGHT, BORROW_LEFT, BORROW_RIGHT, SINGLE_CHILD
     };
 
+    // strategy for the relaxed policies, never borrow
+    EraseStrategy relaxed_erase_strategy(const node_type* node)
+    {
+        if (node == m_root)
+        {
+            return EraseStrategy::ROOT;   // remove root
+        }
+
+        const size_type remaining = node->records.size() - 1;
+        if (remaining >= min_fill())
+        {
+            return EraseStrategy::REMOVE_DIRECTLY;
+        }
+
+        auto left = node->pre;
+        auto right = node->next;
+        const bool has_left_slibing = (left != nullptr && left != &m_header && left->parent == node->parent);
+        const bool has_right_slibing = (right != nullptr && right != &m_header && right->parent == node->parent);
+
+        if (has_left_slibing && remaining + left->records.size() <= order)
+        {
+            return EraseStrategy::MERGE_LEFT; // merge with left one
+        }
+
+        if (has_right_slibing && remaining + right->records.size() <= order)
+        {
+            return EraseStrategy::MERGE_RIGHT; // merge with right one
+        }
+
+        if (remaining > 0)
+        {
+            return EraseStrategy::REMOVE_DIRECTLY;
+        }
+
+        // an empty node without slibings
+        return EraseStrategy::SINGLE_CHILD;
+    }
+
     // strategy for order 2
     template <bool order_eq_2>
     typename std::enable_if<order_eq_2, EraseStrategy>::type erase_strategy(const node_type* node, const RecordIterator& record_iterator)
@@ -904,15 +4581,21 @@ protected:
     // return if upper layer need modifying
     bool erase_helper(node_type*& node, RecordIterator& record_iterator)
     {
-        EraseStrategy strategy = erase_strategy<order == 2>(node, record_iterator);
+        EraseStrategy strategy = erase_policy() == ErasePolicy::EAGER ?
+            erase_strategy<order == 2>(node, record_iterator) : relaxed_erase_strategy(node);
 
-        key_type to_delete_key = record_iterator->first;
         auto left = node->pre;
         auto right = node->next;
 
+        // records of node and its slibings may be erased or moved below
+        bump_version(node);
+        bump_version(left);
+        bump_version(right);
+
         if (strategy == EraseStrategy::ROOT)
         {
             node->records.erase(record_iterator);
+            update_aggregate(node);
             return false;
         }
         else if (strategy == EraseStrategy::MERGE_LEFT)
@@ -923,8 +4606,7 @@ protected:
 
             node->records.erase(record_iterator);
 
-            key_type left_key = (--left->records.end())->first;
-            auto left_in_parent = parent->records.find(left_key);
+            auto left_in_parent = entry_in_parent(left);
 
             for (auto iter = left->records.rbegin(), end = left->records.rend(); iter != end; iter++)
             {
@@ -935,9 +4617,11 @@ protected:
                 node->records.insert(node->records.begin(), std::move(*iter));
             }
 
-            if (need_fix_pos_key_on_path)
+            // the entry of left is still in the parent, a stale one must not be greater than the new key
+            if (need_fix_pos_key_on_path && exact_separators()
+                && !m_innercomp.keycomp((--node->records.end())->first, left_in_parent->first))
             {
-                fix_key_on_path(node, to_delete_key, (--node->records.end())->first);
+                fix_key_on_path(node, (--node->records.end())->first);
             }
 
             if (left->pre != nullptr)
@@ -946,9 +4630,14 @@ protected:
             }
             node->pre = left->pre;
 
-            delete left;
+            if (!node->is_leaf)
+            {
+                buffer_of(node).insert(buffer_of(node).end(), buffer_of(left).begin(), buffer_of(left).end());
+            }
+            free_node(left);
 
             const_cast<node_type*&>(left_in_parent->second) = nullptr;
+            update_aggregate(node);
 
             node = parent;
             record_iterator = left_in_parent;
@@ -958,12 +4647,10 @@ protected:
         {
             node_type* parent = node->parent;
 
-            key_type left_key = (--node->records.end())->first;
+            auto left_in_parent = entry_in_parent(node);
 
             node->records.erase(record_iterator);
 
-            auto left_in_parent = parent->records.find(left_key);
-
             for (auto iter = node->records.begin(), end = node->records.end(); iter != end; )
             {
                 if (iter->second != nullptr)
@@ -980,10 +4667,14 @@ protected:
             }
             right->pre = node->pre;
 
-            delete node;
+            if (!node->is_leaf)
+            {
+                buffer_of(right).insert(buffer_of(right).end(), buffer_of(node).begin(), buffer_of(node).end());
+            }
+            free_node(node);
 
             const_cast<node_type*&>(left_in_parent->second) = nullptr;
-
+            update_aggregate(right);
 
             node = parent;
             record_iterator = left_in_parent;
@@ -993,19 +4684,20 @@ protected:
         {
             bool need_fix_pos_key_on_path = record_iterator == (--node->records.end());
 
-            auto after_erase = node->records.erase(record_iterator);
+            node->records.erase(record_iterator);
 
-            if (need_fix_pos_key_on_path)
+            // the relaxed policies leave the separators stale, they are still not less than the keys
+            if (need_fix_pos_key_on_path && exact_separators())
             {
-                fix_key_on_path(node, to_delete_key, (--node->records.end())->first);
+                fix_key_on_path(node, (--node->records.end())->first);
             }
+            update_aggregate_path(node);
             return false;
         }
         else if (strategy == EraseStrategy::BORROW_RIGHT)
         {
-            key_type old_key = (--node->records.end())->first;
             key_type new_key = right->records.begin()->first;
-            fix_key_on_path(node, old_key, new_key);
+            fix_key_on_path(node, new_key);
 
             node->records.erase(record_iterator);
             auto right_first_iter = right->records.begin();
@@ -1017,6 +4709,14 @@ protected:
             node->records.insert(node->records.end(), *right_first_iter);
             right->records.erase(right_first_iter);
 
+            // the moved record may come from another subtree, carry its messages up to the common ancestor
+            for (node_type *from = right, *to = node; from != to; from = from->parent, to = to->parent)
+            {
+                move_buffer(from, to, new_key, true);
+            }
+
+            update_aggregate_path(node);
+            update_aggregate_path(right);
             return false;
         }
         else if (strategy == EraseStrategy::BORROW_LEFT)
@@ -1026,8 +4726,6 @@ protected:
             node->records.erase(record_iterator);
             auto left_last_iter = --left->records.end();
 
-            key_type left_old_key = left_last_iter->first;
-
             if (left_last_iter->second != nullptr)
             {
                 left_last_iter->second->parent = node;
@@ -1037,14 +4735,20 @@ protected:
             left_last_iter = left->records.erase(left_last_iter);
             key_type left_new_key = (--left_last_iter)->first;
 
-            fix_key_on_path(left, left_old_key, left_new_key);
+            fix_key_on_path(left, left_new_key);
+            for (node_type *from = left, *to = node; from != to; from = from->parent, to = to->parent)
+            {
+                move_buffer(from, to, left_new_key, false);
+            }
 
-            if (need_fix_pos_key_on_path)
+            if (need_fix_pos_key_on_path && exact_separators())
             {
                 key_type new_key = (--node->records.end())->first;
-                fix_key_on_path(node, to_delete_key, new_key);
+                fix_key_on_path(node, new_key);
             }
 
+            update_aggregate_path(node);
+            update_aggregate_path(left);
             return false;
         }
         // single child
@@ -1070,7 +4774,8 @@ protected:
                 }
             }
 
-            delete node;
+            move_buffer_up(node);
+            free_node(node);
 
             node = parent;
             record_iterator = parent->records.begin();
@@ -1079,9 +4784,73 @@ protected:
     }
 
 private:
+    // state of the optional features, a tree that never enables one doesn't allocate it
+    struct Extras
+    {
+        node_type* compact_cursor = nullptr;    // leaf where compact_step continues
+        ErasePolicy erase_policy = ErasePolicy::EAGER;
+        size_type min_fill = 1u;                // used by the relaxed erase policies
+        SplitPolicy split_policy = SplitPolicy::EVEN;
+        double split_skew = 0.9;
+        size_type append_run = 0u;              // inserts at the end of a leaf in a row
+        size_type prepend_run = 0u;             // inserts at the beginning of a leaf in a row
+        size_type buffer_capacity = 0u;         // pending messages per inner node, 0: no buffering
+        std::vector<Message>* applying = nullptr;   // messages being applied by flush_from
+        size_type learned_epsilon = 0u;         // error bound of the learned index, 0: disabled
+        bool learned_valid = false;             // the snapshot matches the leaves
+        size_type learned_lookups = 0u;         // lookups since the model became invalid
+        size_type learned_splits = 0u;          // leaf splits since the snapshot
+        std::vector<node_type*> learned_leaves; // snapshot of the leaf chain
+        std::vector<key_type> learned_keys;     // first key of every leaf in the snapshot
+        std::vector<LearnedSegment> learned_segments;
+        BlockedBloomFilter<key_type, KeyHash> filter;  // keys in the leaves, empty until the next insert rebuilds it
+        size_type filter_bits = 0u;             // bits per key of the filter, 0: no filter
+        size_type filter_changes = 0u;          // inserts and erases since the filter was built
+        std::vector<CacheEntry> cache;          // cache_ways entries per set
+        size_type cache_epoch = 0u;             // bumped by clear() and moves, which drop all entries
+        size_type version_clock = 0u;           // last version given to a leaf, none has a greater one
+        CacheStats cache_stats;
+
+        // the same features for another tree, without any state
+        std::unique_ptr<Extras> settings() const
+        {
+            std::unique_ptr<Extras> result(new Extras());
+            result->erase_policy = erase_policy;
+            result->min_fill = min_fill;
+            result->split_policy = split_policy;
+            result->split_skew = split_skew;
+            result->buffer_capacity = buffer_capacity;
+            result->learned_epsilon = learned_epsilon;
+            result->filter_bits = filter_bits;
+            result->cache.resize(cache.size());
+            return result;
+        }
+    };
+
+    Extras& own_extras()
+    {
+        if (m_extras == nullptr)
+        {
+            m_extras.reset(new Extras());
+        }
+        return *m_extras;
+    }
+
+    size_type min_fill() const
+    {
+        return m_extras != nullptr ? m_extras->min_fill : 1u;
+    }
+
     node_type* m_root = nullptr;
+    size_type m_pending = 0u;               // messages in all buffers
+    std::unique_ptr<Extras> m_extras;       // state of the optional features, allocated by their setters
     InnerCompare m_innercomp;
-    node_type m_header;
     size_type m_size = 0u;
+    // one member is alive, see set_root
+    union
+    {
+        LeafNode m_header;
+        SmallKeys m_small;                  // sorted keys of a small tree, see small_capacity
+    };
 };
 
@@ -0,0 +1,653 @@
+#pragma once
+
+#include <type_traits>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#define FROZEN_BPLUSTREE_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define FROZEN_BPLUSTREE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define FROZEN_BPLUSTREE_PREFETCH(address) ((void)0)
+#endif
+
+// Leaves of a FrozenBPlusTree: all keys in one sorted array, cut into leaves of leaf_size
+// keys, the last one padded with copies of the last key.
+//
+// key_type
+template <typename T>
+class FrozenPlainLeaves
+{
+public:
+    using key_type = T;
+    using size_type = std::size_t;
+    using const_iterator = typename std::vector<key_type>::const_iterator;
+
+    // one leaf fills a cache line (64 bytes), but holds at least 2 keys
+    static constexpr size_type leaf_size = sizeof(key_type) * 2 > 64 ? 2 : 64 / sizeof(key_type);
+
+    // keys are sorted and unique
+    void assign(std::vector<key_type>&& keys)
+    {
+        m_keys = std::move(keys);
+        m_keys.reserve((m_keys.size() + leaf_size - 1) / leaf_size * leaf_size);
+        while (m_keys.size() % leaf_size != 0)
+        {
+            key_type last = m_keys.back();
+            m_keys.push_back(last);
+        }
+    }
+
+    size_type leaf_count() const
+    {
+        return m_keys.size() / leaf_size;
+    }
+
+    key_type leaf_last(size_type leaf) const
+    {
+        return m_keys[leaf * leaf_size + leaf_size - 1];
+    }
+
+    void prefetch(size_type leaf) const
+    {
+        FROZEN_BPLUSTREE_PREFETCH(&m_keys[leaf * leaf_size]);
+    }
+
+    // number of keys k in a leaf for which before(k, key) holds, no branch on the result
+    template <typename Before>
+    size_type rank(size_type leaf, const key_type& key, Before before) const
+    {
+        const key_type* keys = &m_keys[leaf * leaf_size];
+        size_type count = 0;
+        for (size_type i = 0; i < leaf_size; i++)
+        {
+            count += before(keys[i], key) ? 1 : 0;
+        }
+        return count;
+    }
+
+    const_iterator at(size_type position) const
+    {
+        return m_keys.begin() + position;
+    }
+
+    // bytes on the heap
+    size_type memory_footprint() const
+    {
+        return m_keys.capacity() * sizeof(key_type);
+    }
+
+private:
+    std::vector<key_type> m_keys;   // sorted keys, padded to whole leaves
+};
+
+// Frame-of-reference leaves of a FrozenBPlusTree for integral keys under std::less,
+// built by BPlusTree::freeze_packed().
+//
+// A leaf of leaf_size keys stores its first key as the base and every key as the difference
+// to the base, bit-packed with the width of the largest difference. Since all differences
+// of a leaf have the same width, any position can be unpacked without the previous ones,
+// so a leaf is binary searched in place. A leaf whose differences are too wide to save
+// memory keeps its keys raw.
+//
+// For example, if leaf_size = 4, the keys 1000 1001 1003 1006 | 5000 9000000 ... are stored as:
+//
+// leaf 0:   base 1000, width 3,  deltas 0 1 3 6          (12 bits)
+// leaf 1:   base 5000, width 24, deltas 0 8995000 ...    (raw if the width is above raw_width)
+//
+// key_type
+template <typename T>
+class FrozenPackedLeaves
+{
+    static_assert(std::is_integral<T>::value, "FrozenPackedLeaves requires an integral key type");
+
+public:
+    using key_type = T;
+    using size_type = std::size_t;
+
+    static constexpr size_type leaf_size = 128u;
+
+    // widths above raw_width save less than a quarter of a raw key, such leaves are kept raw
+    static constexpr unsigned raw_width = sizeof(key_type) * 8u * 3u / 4u;
+
+    class const_iterator;
+
+private:
+    using unsigned_type = typename std::make_unsigned<key_type>::type;
+    using word_type = std::uint64_t;
+
+    static constexpr unsigned word_bits = 64u;
+
+    struct Leaf
+    {
+        key_type base;
+        size_type offset;       // bit offset in m_words, or index in m_raw
+        unsigned char width;    // bits of a packed difference
+        bool raw;               // keys are stored in m_raw
+    };
+
+public:
+    // random access iterator which unpacks the key it points to
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = key_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = key_type;
+
+        const_iterator() = default;
+
+        const_iterator(const FrozenPackedLeaves* leaves, size_type position)
+            : m_leaves(leaves), m_position(position)
+        {
+        }
+
+        key_type operator*() const
+        {
+            return m_leaves->key_at(m_position);
+        }
+
+        key_type operator[](difference_type n) const
+        {
+            return m_leaves->key_at(m_position + n);
+        }
+
+        const_iterator& operator++()
+        {
+            m_position++;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator res = *this;
+            m_position++;
+            return res;
+        }
+
+        const_iterator& operator--()
+        {
+            m_position--;
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            const_iterator res = *this;
+            m_position--;
+            return res;
+        }
+
+        const_iterator& operator+=(difference_type n)
+        {
+            m_position += n;
+            return *this;
+        }
+
+        const_iterator& operator-=(difference_type n)
+        {
+            m_position -= n;
+            return *this;
+        }
+
+        const_iterator operator+(difference_type n) const
+        {
+            return const_iterator(m_leaves, m_position + n);
+        }
+
+        const_iterator operator-(difference_type n) const
+        {
+            return const_iterator(m_leaves, m_position - n);
+        }
+
+        difference_type operator-(const const_iterator& ano) const
+        {
+            return static_cast<difference_type>(m_position) - static_cast<difference_type>(ano.m_position);
+        }
+
+        bool operator==(const const_iterator& ano) const
+        {
+            return m_position == ano.m_position;
+        }
+
+        bool operator!=(const const_iterator& ano) const
+        {
+            return m_position != ano.m_position;
+        }
+
+        bool operator<(const const_iterator& ano) const
+        {
+            return m_position < ano.m_position;
+        }
+
+        bool operator>(const const_iterator& ano) const
+        {
+            return m_position > ano.m_position;
+        }
+
+        bool operator<=(const const_iterator& ano) const
+        {
+            return m_position <= ano.m_position;
+        }
+
+        bool operator>=(const const_iterator& ano) const
+        {
+            return m_position >= ano.m_position;
+        }
+
+    private:
+        const FrozenPackedLeaves* m_leaves = nullptr;
+        size_type m_position = 0u;
+    };
+
+    // keys are sorted and unique
+    void assign(std::vector<key_type>&& keys)
+    {
+        m_size = keys.size();
+        m_leaves.reserve(m_size / leaf_size + 1);
+
+        size_type bits = 0u;
+        for (size_type first = 0; first < m_size; first += leaf_size)
+        {
+            const size_type last = std::min(first + leaf_size, m_size);
+
+            Leaf leaf;
+            leaf.base = keys[first];
+            leaf.width = static_cast<unsigned char>(width_of(difference(keys[last - 1], keys[first])));
+            leaf.raw = leaf.width > raw_width;
+
+            if (leaf.raw)
+            {
+                leaf.offset = m_raw.size();
+                m_raw.insert(m_raw.end(), keys.begin() + first, keys.begin() + last);
+            }
+            else
+            {
+                leaf.offset = bits;
+                bits += leaf.width * (last - first);
+                m_words.resize(bits / word_bits + 2, 0u); // one more word, unpack may read it
+                for (size_type i = first; i < last; i++)
+                {
+                    pack(leaf.offset + leaf.width * (i - first), leaf.width, difference(keys[i], leaf.base));
+                }
+            }
+
+            m_leaves.push_back(leaf);
+        }
+
+        m_words.shrink_to_fit();
+    }
+
+    size_type leaf_count() const
+    {
+        return m_leaves.size();
+    }
+
+    key_type leaf_last(size_type leaf) const
+    {
+        return key_in(m_leaves[leaf], std::min(m_size - leaf * leaf_size, size_type(leaf_size)) - 1);
+    }
+
+    void prefetch(size_type leaf) const
+    {
+        FROZEN_BPLUSTREE_PREFETCH(&m_leaves[leaf]);
+    }
+
+    // number of keys k in a leaf for which before(k, key) holds; the halving has no branch
+    // on the result, so it compiles to conditional moves
+    template <typename Before>
+    size_type rank(size_type leaf, const key_type& key, Before before) const
+    {
+        const Leaf& node = m_leaves[leaf];
+        const size_type count = std::min(m_size - leaf * leaf_size, size_type(leaf_size));
+
+        size_type position = 0u;
+        for (size_type n = count; n > 1; )
+        {
+            const size_type half = n / 2;
+            position = before(key_in(node, position + half - 1), key) ? position + half : position;
+            n -= half;
+        }
+        return position + (before(key_in(node, position), key) ? 1 : 0);
+    }
+
+    const_iterator at(size_type position) const
+    {
+        return const_iterator(this, position);
+    }
+
+    // number of leaves kept raw
+    size_type raw_leaves() const
+    {
+        return static_cast<size_type>(std::count_if(m_leaves.begin(), m_leaves.end(),
+            [](const Leaf& leaf) { return leaf.raw; }));
+    }
+
+    // bytes on the heap
+    size_type memory_footprint() const
+    {
+        return m_words.capacity() * sizeof(word_type) + m_raw.capacity() * sizeof(key_type)
+            + m_leaves.capacity() * sizeof(Leaf);
+    }
+
+private:
+    static word_type difference(const key_type& key, const key_type& base)
+    {
+        return static_cast<word_type>(static_cast<unsigned_type>(key) - static_cast<unsigned_type>(base));
+    }
+
+    static unsigned width_of(word_type value)
+    {
+        unsigned width = 0u;
+        for (; value != 0; value >>= 1)
+        {
+            width++;
+        }
+        return width;
+    }
+
+    static word_type mask(unsigned width)
+    {
+        return width >= word_bits ? ~word_type(0) : (word_type(1) << width) - 1;
+    }
+
+    void pack(size_type bit, unsigned width, word_type value)
+    {
+        const size_type word = bit / word_bits;
+        const unsigned shift = static_cast<unsigned>(bit % word_bits);
+
+        m_words[word] |= value << shift;
+        if (shift != 0 && shift + width > word_bits)
+        {
+            m_words[word + 1] |= value >> (word_bits - shift);
+        }
+    }
+
+    word_type unpack(size_type bit, unsigned width) const
+    {
+        const size_type word = bit / word_bits;
+        const unsigned shift = static_cast<unsigned>(bit % word_bits);
+
+        word_type value = m_words[word] >> shift;
+        if (shift != 0 && shift + width > word_bits)
+        {
+            value |= m_words[word + 1] << (word_bits - shift);
+        }
+        return value & mask(width);
+    }
+
+    // the i-th key of a leaf
+    key_type key_in(const Leaf& leaf, size_type i) const
+    {
+        if (leaf.raw)
+        {
+            return m_raw[leaf.offset + i];
+        }
+        return static_cast<key_type>(static_cast<unsigned_type>(leaf.base)
+            + static_cast<unsigned_type>(unpack(leaf.offset + leaf.width * i, leaf.width)));
+    }
+
+    key_type key_at(size_type position) const
+    {
+        return key_in(m_leaves[position / leaf_size], position % leaf_size);
+    }
+
+private:
+    std::vector<word_type> m_words;     // packed differences of all packed leaves
+    std::vector<key_type> m_raw;        // keys of the raw leaves
+    std::vector<Leaf> m_leaves;
+    size_type m_size = 0u;
+};
+
+// An immutable B+ Tree without pointers, built by BPlusTree::freeze() or
+// BPlusTree::freeze_packed().
+//
+// The sorted keys are cut into leaves, stored by the Leaves policy: FrozenPlainLeaves keeps
+// them in one array, FrozenPackedLeaves bit-packs each leaf. Each inner layer holds the
+// maximum of every block of the layer below (the leaves for the lowest one) and is cut
+// into blocks of block_size again, until a single block is left on the top. The children
+// of block b are the blocks (or leaves) b * block_size ... b * block_size + block_size - 1
+// of the layer below, so a lookup counts the keys less than the target in one block per
+// layer (no branch on the result) and prefetches the next block before reading it.
+//
+// For example, if block_size = 2 and the leaves hold 2 keys, the keys 1 2 3 4 5 6 7 are stored as:
+//
+// layer=1:   [4,     7]                         (the last block is padded with its last key)
+// layer=2:   [2, 4] [6, 7]
+// leaves:    [1, 2] [3, 4] [5, 6] [7, 7]
+//
+// key_type, comparator, leaves' layout
+template <typename T, typename Compare = std::less<T>, typename Leaves = FrozenPlainLeaves<T>>
+class FrozenBPlusTree
+{
+public:
+    using key_type = T;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+    using leaves_type = Leaves;
+
+    using iterator = typename Leaves::const_iterator;
+    using const_iterator = iterator;
+
+    // one block fills a cache line (64 bytes), but holds at least 2 keys
+    static constexpr size_type block_size = sizeof(key_type) * 2 > 64 ? 2 : 64 / sizeof(key_type);
+
+public:
+    FrozenBPlusTree()
+        : FrozenBPlusTree(Compare())
+    {
+    }
+
+    FrozenBPlusTree(const Compare& keycomp)
+        : m_keycomp(keycomp)
+    {
+    }
+
+    // build from keys which are sorted and unique under keycomp
+    template <typename InputIt>
+    FrozenBPlusTree(InputIt first, InputIt last, const Compare& keycomp = Compare())
+        : m_keycomp(keycomp)
+    {
+        std::vector<key_type> keys(first, last);
+        assert(std::adjacent_find(keys.begin(), keys.end(),
+            [&](const key_type& lhs, const key_type& rhs) { return !m_keycomp(lhs, rhs); }) == keys.end());
+
+        build(std::move(keys));
+    }
+
+    // --------------- lookup ---------------
+
+    const_iterator find(const key_type& key) const
+    {
+        auto lb = lower_bound(key);
+        return lb != end() && !m_keycomp(key, *lb) ? lb : end();
+    }
+
+    const_iterator lower_bound(const key_type& key) const
+    {
+        // count the keys less than key
+        return search(key, [this](const key_type& lhs, const key_type& rhs) { return m_keycomp(lhs, rhs); });
+    }
+
+    const_iterator upper_bound(const key_type& key) const
+    {
+        // count the keys not greater than key
+        return search(key, [this](const key_type& lhs, const key_type& rhs) { return !m_keycomp(rhs, lhs); });
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    bool contains(const key_type& key) const
+    {
+        return find(key) != end();
+    }
+
+    // --------------- iterator ---------------
+
+    const_iterator begin() const
+    {
+        return m_leaves.at(0u);
+    }
+
+    const_iterator end() const
+    {
+        return m_leaves.at(m_size);
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    // ------------------------------------------------
+    size_type size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    const leaves_type& leaves() const
+    {
+        return m_leaves;
+    }
+
+    // bytes of the leaves and all inner layers, including the padding
+    size_type memory_footprint() const
+    {
+        return sizeof(*this) + m_layers.capacity() * sizeof(key_type)
+            + m_layer_offsets.capacity() * sizeof(size_type) + m_leaves.memory_footprint();
+    }
+
+private:
+    void build(std::vector<key_type>&& keys)
+    {
+        m_size = keys.size();
+        if (m_size == 0)
+        {
+            return;
+        }
+
+        m_leaves.assign(std::move(keys));
+
+        // build the layers bottom-up, then store them top-down
+        std::vector<std::vector<key_type>> layers;
+        if (m_leaves.leaf_count() > 1)
+        {
+            std::vector<key_type> layer;
+            layer.reserve(m_leaves.leaf_count() + block_size);
+            for (size_type leaf = 0; leaf < m_leaves.leaf_count(); leaf++)
+            {
+                layer.push_back(m_leaves.leaf_last(leaf));
+            }
+            pad(layer);
+            layers.push_back(std::move(layer));
+        }
+        while (!layers.empty() && layers.back().size() > block_size)
+        {
+            const std::vector<key_type>& below = layers.back();
+            std::vector<key_type> layer;
+            layer.reserve(below.size() / block_size + block_size);
+            for (size_type i = block_size - 1; i < below.size(); i += block_size)
+            {
+                layer.push_back(below[i]);
+            }
+            pad(layer);
+            layers.push_back(std::move(layer));
+        }
+
+        for (auto iter = layers.rbegin(); iter != layers.rend(); iter++)
+        {
+            m_layer_offsets.push_back(m_layers.size());
+            m_layers.insert(m_layers.end(), iter->begin(), iter->end());
+        }
+    }
+
+    // pad the last block with copies of the last key
+    static void pad(std::vector<key_type>& layer)
+    {
+        layer.reserve((layer.size() + block_size - 1) / block_size * block_size);
+        while (layer.size() % block_size != 0)
+        {
+            key_type last = layer.back();
+            layer.push_back(last);
+        }
+    }
+
+    // number of keys k in a block for which before(k, key) holds
+    template <typename Before>
+    static size_type rank(const key_type* block, const key_type& key, Before before)
+    {
+        size_type count = 0;
+        for (size_type i = 0; i < block_size; i++)
+        {
+            count += before(block[i], key) ? 1 : 0;
+        }
+        return count;
+    }
+
+    // position of the first key k for which before(k, key) doesn't hold
+    template <typename Before>
+    const_iterator search(const key_type& key, Before before) const
+    {
+        if (m_size == 0)
+        {
+            return end();
+        }
+
+        size_type block = 0;
+        for (size_type layer = 0; layer < m_layer_offsets.size(); layer++)
+        {
+            size_type count = rank(&m_layers[m_layer_offsets[layer] + block * block_size], key, before);
+            if (count == block_size)
+            {
+                // only happens on the top, key is after all keys
+                return end();
+            }
+
+            block = block * block_size + count;
+            if (layer + 1 < m_layer_offsets.size())
+            {
+                FROZEN_BPLUSTREE_PREFETCH(&m_layers[m_layer_offsets[layer + 1] + block * block_size]);
+            }
+            else
+            {
+                m_leaves.prefetch(block);
+            }
+        }
+
+        // the padding of the lowest layer may route past the last leaf
+        if (block >= m_leaves.leaf_count())
+        {
+            return end();
+        }
+        size_type position = block * Leaves::leaf_size + m_leaves.rank(block, key, before);
+        return position < m_size ? m_leaves.at(position) : end();
+    }
+
+private:
+    Leaves m_leaves;
+    std::vector<key_type> m_layers;           // inner layers, from the top to the bottom
+    std::vector<size_type> m_layer_offsets;   // offset of each layer in m_layers
+    size_type m_size = 0u;
+    Compare m_keycomp;
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <type_traits>
+#include <stdexcept>
+#include <utility>
+#include <string>
+#include <tuple>
+#include <array>
+#include <cstring>
+#include <cstdint>
+
+// Order-preserving binary encoding of composite keys.
+//
+// The fields are encoded one after another into a byte string, so that comparing two
+// encoded keys byte by byte (std::less<std::string>, a memcmp) orders them as comparing
+// the fields in turn would. A BPlusTree<std::string> of encoded keys then compares each
+// key once instead of field by field, and all keys starting with some leading fields
+// form one range, see prefix_range.
+//
+// integers:     big-endian, the sign bit flipped for signed types
+// bool:         one byte, 0 or 1
+// float/double: big-endian bits, all bits flipped if negative, else the sign bit
+//               (-0.0 sorts before +0.0, NaNs after +inf or before -inf by their sign)
+// strings:      bytes with 0x00 escaped as 0x00 0xff, terminated by 0x00 0x01
+//
+// For example, the tuple (uint16_t 3, "ab", int8_t -1) is encoded as
+//   00 03 | 61 62 00 01 | 7f
+//
+// Encoded keys longer than the small string buffer live on the heap, so every comparison of
+// std::string keys follows a pointer. NormalizedKey keeps them inline instead.
+struct KeyEncoding
+{
+    // encode the fields in turn
+    template <typename... Fields>
+    static std::string encode(const Fields&... fields)
+    {
+        std::string out;
+        append_all(out, fields...);
+        return out;
+    }
+
+    template <typename... Fields>
+    static std::string encode(const std::tuple<Fields...>& fields)
+    {
+        std::string out;
+        append_tuple(out, fields, std::index_sequence_for<Fields...>());
+        return out;
+    }
+
+    // decode a key encoded from the fields of types Fields..., throw std::invalid_argument
+    // if it's malformed
+    template <typename... Fields>
+    static std::tuple<Fields...> decode(const std::string& key)
+    {
+        std::tuple<Fields...> fields;
+        std::size_t pos = 0;
+        read_tuple(key, pos, fields, std::index_sequence_for<Fields...>());
+        if (pos != key.size())
+        {
+            throw std::invalid_argument("decode a key with trailing bytes");
+        }
+        return fields;
+    }
+
+    // --------------- append one field ---------------
+
+    template <typename U>
+    static typename std::enable_if<std::is_integral<U>::value && !std::is_same<U, bool>::value>::type
+    append(std::string& out, U value)
+    {
+        using Unsigned = typename std::make_unsigned<U>::type;
+        append_big_endian(out, static_cast<Unsigned>(static_cast<Unsigned>(value) ^ sign_bit<U>()));
+    }
+
+    static void append(std::string& out, bool value)
+    {
+        out.push_back(value ? '\x01' : '\x00');
+    }
+
+    static void append(std::string& out, float value)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        append_big_endian(out, flip_float_bits(bits));
+    }
+
+    static void append(std::string& out, double value)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        append_big_endian(out, flip_float_bits(bits));
+    }
+
+    static void append(std::string& out, const std::string& value)
+    {
+        append_string(out, value.data(), value.size());
+    }
+
+    static void append(std::string& out, const char* value)
+    {
+        append_string(out, value, std::strlen(value));
+    }
+
+private:
+    template <typename U>
+    static typename std::make_unsigned<U>::type sign_bit()
+    {
+        using Unsigned = typename std::make_unsigned<U>::type;
+        return std::is_signed<U>::value ? static_cast<Unsigned>(Unsigned(1) << (sizeof(U) * 8 - 1)) : Unsigned(0);
+    }
+
+    template <typename Unsigned>
+    static Unsigned flip_float_bits(Unsigned bits)
+    {
+        const Unsigned sign = Unsigned(1) << (sizeof(Unsigned) * 8 - 1);
+        return (bits & sign) != 0 ? static_cast<Unsigned>(~bits) : static_cast<Unsigned>(bits | sign);
+    }
+
+    template <typename Unsigned>
+    static void append_big_endian(std::string& out, Unsigned bits)
+    {
+        for (std::size_t i = sizeof(Unsigned); i-- > 0; )
+        {
+            out.push_back(static_cast<char>((bits >> (i * 8)) & 0xffu));
+        }
+    }
+
+    static void append_string(std::string& out, const char* data, std::size_t size)
+    {
+        out.reserve(out.size() + size + 2);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            out.push_back(data[i]);
+            if (data[i] == '\0')
+            {
+                out.push_back('\xff');
+            }
+        }
+        out.push_back('\x00');
+        out.push_back('\x01');
+    }
+
+    static void append_all(std::string&)
+    {
+    }
+
+    template <typename Field, typename... Rest>
+    static void append_all(std::string& out, const Field& field, const Rest&... rest)
+    {
+        append(out, field);
+        append_all(out, rest...);
+    }
+
+    template <typename Tuple, std::size_t... I>
+    static void append_tuple(std::string& out, const Tuple& fields, std::index_sequence<I...>)
+    {
+        append_all(out, std::get<I>(fields)...);
+    }
+
+    // --------------- read one field ---------------
+
+    template <typename Unsigned>
+    static Unsigned read_big_endian(const std::string& in, std::size_t& pos)
+    {
+        if (in.size() - pos < sizeof(Unsigned))
+        {
+            throw std::invalid_argument("decode a truncated key");
+        }
+        Unsigned bits = 0;
+        for (std::size_t i = 0; i < sizeof(Unsigned); i++)
+        {
+            bits = static_cast<Unsigned>((bits << 8) | static_cast<unsigned char>(in[pos++]));
+        }
+        return bits;
+    }
+
+    template <typename U>
+    static typename std::enable_if<std::is_integral<U>::value && !std::is_same<U, bool>::value>::type
+    read(const std::string& in, std::size_t& pos, U& value)
+    {
+        using Unsigned = typename std::make_unsigned<U>::type;
+        value = static_cast<U>(static_cast<Unsigned>(read_big_endian<Unsigned>(in, pos) ^ sign_bit<U>()));
+    }
+
+    static void read(const std::string& in, std::size_t& pos, bool& value)
+    {
+        value = read_big_endian<std::uint8_t>(in, pos) != 0;
+    }
+
+    static void read(const std::string& in, std::size_t& pos, float& value)
+    {
+        std::uint32_t bits = read_big_endian<std::uint32_t>(in, pos);
+        bits = (bits & 0x80000000u) != 0 ? bits & 0x7fffffffu : ~bits;
+        std::memcpy(&value, &bits, sizeof(bits));
+    }
+
+    static void read(const std::string& in, std::size_t& pos, double& value)
+    {
+        std::uint64_t bits = read_big_endian<std::uint64_t>(in, pos);
+        bits = (bits & 0x8000000000000000ull) != 0 ? bits & 0x7fffffffffffffffull : ~bits;
+        std::memcpy(&value, &bits, sizeof(bits));
+    }
+
+    static void read(const std::string& in, std::size_t& pos, std::string& value)
+    {
+        value.clear();
+        while (true)
+        {
+            if (in.size() - pos < 2 && (pos == in.size() || in[pos] == '\0'))
+            {
+                throw std::invalid_argument("decode a truncated key");
+            }
+            if (in[pos] != '\0')
+            {
+                value.push_back(in[pos++]);
+            }
+            else if (in[pos + 1] == '\xff')
+            {
+                value.push_back('\0');
+                pos += 2;
+            }
+            else if (in[pos + 1] == '\x01')
+            {
+                pos += 2;
+                return;
+            }
+            else
+            {
+                throw std::invalid_argument("decode a string with a bad escape");
+            }
+        }
+    }
+
+    template <typename Tuple, std::size_t... I>
+    static void read_tuple(const std::string& in, std::size_t& pos, Tuple& fields, std::index_sequence<I...>)
+    {
+        // braced lists are evaluated in order
+        int expand[] = { 0, (read(in, pos, std::get<I>(fields)), 0)... };
+        (void)expand;
+    }
+};
+
+// An encoded key of at most Capacity bytes stored inline, compared by one memcmp of
+// fixed length. The unused bytes are zero, which breaks no order: a key sorts after
+// every proper prefix of it, and the length decides between a prefix and the same
+// bytes followed by zeros.
+template <std::size_t Capacity>
+class NormalizedKey
+{
+    static_assert(Capacity > 0 && Capacity <= 255, "NormalizedKey holds 1 to 255 bytes");
+
+public:
+    NormalizedKey() = default;
+
+    // throw std::length_error if bytes are longer than Capacity
+    explicit NormalizedKey(const std::string& bytes)
+    {
+        if (bytes.size() > Capacity)
+        {
+            throw std::length_error("normalized key longer than its capacity");
+        }
+        std::memcpy(m_bytes.data(), bytes.data(), bytes.size());
+        m_size = static_cast<unsigned char>(bytes.size());
+    }
+
+    std::string bytes() const
+    {
+        return std::string(reinterpret_cast<const char*>(m_bytes.data()), m_size);
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    bool operator<(const NormalizedKey& ano) const
+    {
+        const int res = std::memcmp(m_bytes.data(), ano.m_bytes.data(), Capacity);
+        return res != 0 ? res < 0 : m_size < ano.m_size;
+    }
+
+    bool operator==(const NormalizedKey& ano) const
+    {
+        return m_size == ano.m_size && std::memcmp(m_bytes.data(), ano.m_bytes.data(), Capacity) == 0;
+    }
+
+    bool operator!=(const NormalizedKey& ano) const
+    {
+        return !(*this == ano);
+    }
+
+private:
+    std::array<unsigned char, Capacity> m_bytes{};
+    unsigned char m_size = 0u;
+};
+
+// The range [first, last) of a tree of encoded keys whose leading fields equal fields.
+// The fields must have the types the keys were encoded from, e.g. prefix_range(tree,
+// uint32_t(7)) for keys encoded from std::tuple<uint32_t, std::string, int64_t>.
+// The key type of the tree is std::string or NormalizedKey.
+template <typename Tree, typename... Fields>
+auto prefix_range(Tree& tree, const Fields&... fields) -> std::pair<decltype(tree.begin()), decltype(tree.begin())>
+{
+    using key_type = typename Tree::key_type;
+
+    std::string prefix = KeyEncoding::encode(fields...);
+    auto first = tree.lower_bound(key_type(prefix));
+
+    // the least string greater than every string starting with prefix
+    while (!prefix.empty() && prefix.back() == '\xff')
+    {
+        prefix.pop_back();
+    }
+    if (prefix.empty())
+    {
+        return { first, tree.end() };
+    }
+    prefix.back() = static_cast<char>(static_cast<unsigned char>(prefix.back()) + 1);
+    return { first, tree.lower_bound(key_type(prefix)) };
+}
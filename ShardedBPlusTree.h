@@ -0,0 +1,456 @@
+#pragma once
+
+#include <type_traits>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "BPlusTree.h"
+
+// A B+ Tree cut by key range into independent BPlusTree shards, for many writer threads.
+//
+// Shard i holds the keys in [bound i - 1, bound i), each shard has its own mutex, so
+// insert, erase and a lookup lock only the shard of their key and writers on different
+// ranges never meet at a common root.
+//
+// A shard that grows beyond 1.5 times its share of the keys (and min_shard_size) is split
+// at the median of a reservoir sample of the keys inserted into it, so the boundaries
+// follow the observed key distribution. To stay near the target count, the adjacent pair
+// with the fewest keys is merged afterwards if the merged shard stays below that limit,
+// and a shard that falls below a quarter of it is merged with its smaller neighbour.
+// split_off and join make both O(log n).
+//
+// The shard list is read under a shared lock and changed under the exclusive one, which
+// also waits for the operations in progress. There are no iterators, since a split or
+// merge may free the shard under one at any time; for_each and the copies visit the keys
+// in order under the locks and see each shard at one point in time. f must not modify
+// the tree.
+//
+// key_type, maximum records per node of the shards, comparator
+template <typename T, std::size_t order = 32u, typename Compare = std::less<T>>
+class ShardedBPlusTree
+{
+public:
+    using key_type = T;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+    using tree_type = BPlusTree<T, order, Compare>;
+
+    // keys sampled per shard to pick the split points
+    static constexpr size_type sample_size = 64u;
+
+private:
+    struct Shard
+    {
+        std::mutex mutex;
+        tree_type tree;
+        std::vector<key_type> samples;  // reservoir sample of the inserted keys
+        size_type seen = 0u;            // inserts offered to the reservoir
+        std::uint64_t random;           // xorshift state of the reservoir
+
+        Shard(const Compare& keycomp, std::uint64_t seed)
+            : tree(keycomp), random(seed | 1u)
+        {
+        }
+    };
+
+public:
+    // keep about shards shards (0: one per hardware thread), none smaller than
+    // min_shard_size is split
+    explicit ShardedBPlusTree(size_type shards = 0u, size_type min_shard_size = 4096u, const Compare& keycomp = Compare())
+        : m_keycomp(keycomp), m_min_shard_size(std::max(min_shard_size, size_type(2u)))
+    {
+        m_target_shards = shards != 0 ? shards : std::max(size_type(std::thread::hardware_concurrency()), size_type(1u));
+        m_shards.emplace_back(new Shard(m_keycomp, 1u));
+    }
+
+    // start with the shards cut at bounds, sorted and unique, and keep that many
+    ShardedBPlusTree(const std::vector<key_type>& bounds, size_type min_shard_size = 4096u, const Compare& keycomp = Compare())
+        : ShardedBPlusTree(bounds.size() + 1, min_shard_size, keycomp)
+    {
+        for (size_type i = 0; i < bounds.size(); i++)
+        {
+            if (i != 0 && !m_keycomp(bounds[i - 1], bounds[i]))
+            {
+                throw std::invalid_argument("ShardedBPlusTree bounds must be sorted and unique");
+            }
+            m_bounds.push_back(bounds[i]);
+            m_shards.emplace_back(new Shard(m_keycomp, i + 2));
+        }
+    }
+
+    ShardedBPlusTree(const ShardedBPlusTree&) = delete;
+    ShardedBPlusTree& operator=(const ShardedBPlusTree&) = delete;
+
+    // --------------- writer ---------------
+
+    // return false if key exists
+    bool insert(const key_type& key)
+    {
+        bool inserted = false, split = false;
+        {
+            std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+            Shard& shard = *m_shards[shard_index(key)];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            inserted = shard.tree.insert(key).second;
+            if (inserted)
+            {
+                offer_sample(shard, key);
+                m_size.fetch_add(1u, std::memory_order_relaxed);
+                split = shard.tree.size() > split_threshold();
+            }
+        }
+
+        if (split)
+        {
+            rebalance(key);
+        }
+        return inserted;
+    }
+
+    // return the number of erased keys (0 or 1)
+    size_type erase(const key_type& key)
+    {
+        size_type erased = 0u;
+        bool merge = false;
+        {
+            std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+            Shard& shard = *m_shards[shard_index(key)];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            erased = shard.tree.erase(key);
+            if (erased != 0)
+            {
+                m_size.fetch_sub(1u, std::memory_order_relaxed);
+                merge = m_shards.size() > 1 && shard.tree.size() * 4 < split_threshold();
+            }
+        }
+
+        if (merge)
+        {
+            rebalance(key);
+        }
+        return erased;
+    }
+
+    // erase all keys, the shards keep their bounds
+    void clear()
+    {
+        exclusive_section([&]()
+        {
+            for (auto& shard : m_shards)
+            {
+                shard->tree.clear();
+                shard->samples.clear();
+                shard->seen = 0u;
+            }
+            m_size.store(0u, std::memory_order_relaxed);
+        });
+    }
+
+    // --------------- reader ---------------
+
+    bool contains(const key_type& key) const
+    {
+        std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+        Shard& shard = *m_shards[shard_index(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.tree.contains(key);
+    }
+
+    // call f on the keys in [lo, hi] in order, locking one shard at a time
+    template <typename Function>
+    void for_each(const key_type& lo, const key_type& hi, Function f) const
+    {
+        if (m_keycomp(hi, lo))
+        {
+            return;
+        }
+
+        std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+        for (size_type index = shard_index(lo), last = shard_index(hi); index <= last; index++)
+        {
+            Shard& shard = *m_shards[index];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto iter = shard.tree.lower_bound(lo), end = shard.tree.end(); iter != end && !m_keycomp(hi, *iter); ++iter)
+            {
+                f(*iter);
+            }
+        }
+    }
+
+    // call f on all keys in order, locking one shard at a time
+    template <typename Function>
+    void for_each(Function f) const
+    {
+        std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+        for (auto& shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            for (auto iter = shard->tree.begin(), end = shard->tree.end(); iter != end; ++iter)
+            {
+                f(*iter);
+            }
+        }
+    }
+
+    // copy the keys in [lo, hi] to out in order, each shard as of one point in time
+    template <typename OutputIt>
+    OutputIt copy_range(const key_type& lo, const key_type& hi, OutputIt out) const
+    {
+        for_each(lo, hi, [&](const key_type& key)
+        {
+            *out++ = key;
+        });
+        return out;
+    }
+
+    // copy all keys to out in order, each shard as of one point in time
+    template <typename OutputIt>
+    OutputIt copy_all(OutputIt out) const
+    {
+        for_each([&](const key_type& key)
+        {
+            *out++ = key;
+        });
+        return out;
+    }
+
+    size_type size() const
+    {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // ------------------------------------------------
+
+    size_type shard_count() const
+    {
+        std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+        return m_shards.size();
+    }
+
+    // the least key of every shard but the first one
+    std::vector<key_type> bounds() const
+    {
+        std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+        return m_bounds;
+    }
+
+    std::vector<size_type> shard_sizes() const
+    {
+        std::shared_lock<std::shared_timed_mutex> directory(lock_directory());
+        std::vector<size_type> sizes;
+        for (auto& shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            sizes.push_back(shard->tree.size());
+        }
+        return sizes;
+    }
+
+private:
+    size_type shard_index(const key_type& key) const
+    {
+        return static_cast<size_type>(std::upper_bound(m_bounds.begin(), m_bounds.end(), key, m_keycomp) - m_bounds.begin());
+    }
+
+    size_type split_threshold() const
+    {
+        return std::max(m_min_shard_size, 3 * m_size.load(std::memory_order_relaxed) / (2 * m_target_shards));
+    }
+
+    // The rwlock of libstdc++ prefers readers, so under steady traffic a rebalance could
+    // wait forever for the exclusive lock. New operations queue on the gate meanwhile.
+    std::shared_timed_mutex& lock_directory() const
+    {
+        if (m_rebalancing.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> gate(m_gate);
+        }
+        return m_directory;
+    }
+
+    template <typename Change>
+    void exclusive_section(Change change)
+    {
+        std::lock_guard<std::mutex> gate(m_gate);
+        m_rebalancing.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::shared_timed_mutex> directory(m_directory);
+            change();
+        }
+        m_rebalancing.store(false, std::memory_order_release);
+    }
+
+    // Algorithm R: keep every inserted key with probability sample_size / inserts
+    void offer_sample(Shard& shard, const key_type& key)
+    {
+        shard.seen++;
+        if (shard.samples.size() < sample_size)
+        {
+            shard.samples.push_back(key);
+            return;
+        }
+
+        shard.random ^= shard.random << 13;
+        shard.random ^= shard.random >> 7;
+        shard.random ^= shard.random << 17;
+        const size_type slot = static_cast<size_type>(shard.random % shard.seen);
+        if (slot < sample_size)
+        {
+            shard.samples[slot] = key;
+        }
+    }
+
+    // split the shard of key if it's still too large, or merge it if it's still too small
+    void rebalance(const key_type& key)
+    {
+        exclusive_section([&]()
+        {
+            const size_type index = shard_index(key);
+            const size_type threshold = split_threshold();
+            const size_type size = m_shards[index]->tree.size();
+
+            if (size > threshold)
+            {
+                split_shard(index);
+                if (m_shards.size() > m_target_shards)
+                {
+                    merge_smallest_pair(index, threshold);
+                }
+            }
+            else if (m_shards.size() > 1 && size * 4 < threshold)
+            {
+                const bool has_left = index != 0, has_right = index + 1 != m_shards.size();
+                const size_type left = has_left ? m_shards[index - 1]->tree.size() : 0u;
+                const size_type right = has_right ? m_shards[index + 1]->tree.size() : 0u;
+                const size_type neighbour = has_left && (!has_right || left <= right) ? index - 1 : index + 1;
+                if (size + m_shards[neighbour]->tree.size() <= threshold / 2)
+                {
+                    merge_shards(std::min(index, neighbour));
+                }
+            }
+        });
+    }
+
+    // the median of the samples inside the shard, or the middle key if there is none
+    key_type split_key(Shard& shard) const
+    {
+        const tree_type& tree = shard.tree;
+        const key_type& first = *tree.begin();
+        auto last = tree.end();
+        --last;
+
+        std::vector<key_type> inside;
+        for (const key_type& sample : shard.samples)
+        {
+            if (m_keycomp(first, sample) && !m_keycomp(*last, sample))
+            {
+                inside.push_back(sample);
+            }
+        }
+        if (!inside.empty())
+        {
+            auto median = inside.begin() + inside.size() / 2;
+            std::nth_element(inside.begin(), median, inside.end(), m_keycomp);
+            return *median;
+        }
+
+        auto middle = tree.begin();
+        for (size_type i = tree.size() / 2; i > 0; i--)
+        {
+            ++middle;
+        }
+        return *middle;
+    }
+
+    void split_shard(size_type index)
+    {
+        Shard& shard = *m_shards[index];
+        const key_type key = split_key(shard);
+
+        std::unique_ptr<Shard> right(new Shard(m_keycomp, shard.random + index));
+        right->tree = shard.tree.split_off(key);
+
+        // the samples above key move along, the reservoirs start over from them
+        auto moved = std::partition(shard.samples.begin(), shard.samples.end(),
+            [&](const key_type& sample) { return m_keycomp(sample, key); });
+        right->samples.assign(moved, shard.samples.end());
+        shard.samples.erase(moved, shard.samples.end());
+        shard.seen = shard.samples.size();
+        right->seen = right->samples.size();
+
+        m_bounds.insert(m_bounds.begin() + index, key);
+        m_shards.insert(m_shards.begin() + index + 1, std::move(right));
+    }
+
+    // merge shard index + 1 into shard index
+    void merge_shards(size_type index)
+    {
+        Shard& left = *m_shards[index];
+        Shard& right = *m_shards[index + 1];
+        left.tree.join(std::move(right.tree));
+
+        left.samples.insert(left.samples.end(), right.samples.begin(), right.samples.end());
+        if (left.samples.size() > sample_size)
+        {
+            // every other one keeps both halves represented
+            size_type kept = 0;
+            for (size_type i = 0; i < left.samples.size(); i += 2)
+            {
+                left.samples[kept++] = left.samples[i];
+            }
+            left.samples.resize(kept);
+        }
+        left.seen = left.samples.size();
+
+        m_bounds.erase(m_bounds.begin() + index);
+        m_shards.erase(m_shards.begin() + index + 1);
+    }
+
+    // merge the adjacent pair with the fewest keys, except the halves of shard split,
+    // unless the merged shard would exceed threshold
+    void merge_smallest_pair(size_type split, size_type threshold)
+    {
+        size_type best = m_shards.size(), best_size = threshold + 1;
+        for (size_type i = 0; i + 1 < m_shards.size(); i++)
+        {
+            const size_type size = m_shards[i]->tree.size() + m_shards[i + 1]->tree.size();
+            if (i != split && size < best_size)
+            {
+                best = i;
+                best_size = size;
+            }
+        }
+        if (best != m_shards.size())
+        {
+            merge_shards(best);
+        }
+    }
+
+private:
+    Compare m_keycomp;
+    size_type m_target_shards = 1u;
+    size_type m_min_shard_size;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::vector<key_type> m_bounds;     // least key of shard i + 1
+    std::atomic<size_type> m_size{ 0u };
+    mutable std::shared_timed_mutex m_directory;
+    mutable std::mutex m_gate;
+    std::atomic<bool> m_rebalancing{ false };
+};
+
+template <typename T, std::size_t order, typename Compare>
+constexpr std::size_t ShardedBPlusTree<T, order, Compare>::sample_size;
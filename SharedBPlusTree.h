@@ -0,0 +1,889 @@
+#pragma once
+
+#include <type_traits>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A B+ Tree whose nodes live in a file mapped by several processes (POSIX only).
+//
+// The whole tree is one segment: a header followed by fixed-size node slots. Nodes link
+// each other by byte offsets from the start of the segment instead of pointers, so every
+// process can map the segment at a different address. A file under /dev/shm is the
+// segment of shm_open without touching the disk.
+//
+// One process writes, any number of processes read at the same time. The writer makes
+// the sequence number of the segment odd while it modifies the tree and even again when
+// it's done. A reader copies what it needs out of the segment, then checks that the
+// sequence number was even and didn't change, otherwise it reads again (a seqlock). The
+// readers never block the writer, and a torn read is detected rather than prevented: the
+// offsets a reader follows are checked against the segment before they're used.
+//
+// A writable handle holds a lock on the file, so a second writer is refused. A reader that
+// keeps seeing an odd sequence number checks that lock and throws std::runtime_error if
+// the writer died in the middle of a modification, instead of waiting forever.
+//
+// The layout follows BPlusTree: an inner record is the maximum of its child, the leaves
+// are linked in both directions through a header node, and erase merges a node only when
+// it becomes empty (like ErasePolicy::FREE_AT_EMPTY), which keeps the separators stale.
+//
+// key_type (trivially copyable), maximum records per node, comparator
+template <typename T, std::size_t order = 32u, typename Compare = std::less<T>>
+class SharedBPlusTree
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SharedBPlusTree requires a trivially copyable key type");
+    static_assert(order >= 3, "SharedBPlusTree requires an order of at least 3");
+
+public:
+    using key_type = T;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+    using offset_type = std::uint64_t;  // bytes from the start of the segment, 0 is null
+
+private:
+    struct Node
+    {
+        offset_type parent;
+        offset_type next;                   // right node in the same layer
+        offset_type pre;                    // left node in the same layer
+        std::uint32_t count;                // records in use
+        std::uint32_t is_leaf;
+        key_type keys[order + 1];           // keys, or the maximum of each child; one spare to split
+        offset_type children[order + 1];
+    };
+
+    struct Segment
+    {
+        char magic[8];
+        std::uint64_t key_size;
+        std::uint64_t node_order;
+        std::uint64_t slot_size;
+        std::uint64_t bytes;                // size of the segment
+        std::atomic<std::uint64_t> sequence;
+        offset_type root;
+        offset_type header;                 // next: first leaf, pre: last leaf
+        std::uint64_t size;
+        std::uint64_t height;
+        offset_type free_list;              // freed slots, linked by next
+        std::uint64_t free_slots;
+        offset_type top;                    // first slot never allocated
+    };
+
+    static constexpr char segment_magic[8] = { 'S', 'B', 'P', 'T', 'R', 'E', 'E', '1' };
+    static constexpr size_type slot_align = 64u;
+    static constexpr size_type slot_size = (sizeof(Node) + slot_align - 1) / slot_align * slot_align;
+    static constexpr size_type first_slot = (sizeof(Segment) + slot_align - 1) / slot_align * slot_align;
+
+    // retries of a reader between two checks whether the writer is still alive
+    static constexpr size_type stuck_retries = 4096u;
+
+#if defined(F_OFD_SETLK)
+    static constexpr int writer_lock_set = F_OFD_SETLK;
+    static constexpr int writer_lock_get = F_OFD_GETLK;
+#else
+    // process-associated locks: closing any handle of the file in the writer's process
+    // drops the lock, and readers in that process don't see it
+    static constexpr int writer_lock_set = F_SETLK;
+    static constexpr int writer_lock_get = F_GETLK;
+#endif
+
+public:
+    // create (or truncate) the segment file at path with room for bytes, and open it for
+    // writing; throw std::runtime_error if another handle writes the segment
+    static SharedBPlusTree create(const std::string& path, size_type bytes, const Compare& keycomp = Compare())
+    {
+        if (bytes < first_slot + 2 * slot_size)
+        {
+            throw std::invalid_argument("segment too small for a node");
+        }
+
+        SharedBPlusTree tree(keycomp);
+        tree.m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (tree.m_fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "create " + path);
+        }
+        // truncate only once no other process writes the segment
+        tree.lock_writer(path);
+        if (::ftruncate(tree.m_fd, 0) != 0 || ::ftruncate(tree.m_fd, static_cast<off_t>(bytes)) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "create " + path);
+        }
+        tree.map(bytes, true);
+
+        Segment* segment = new (tree.m_base) Segment;
+        if (!segment->sequence.is_lock_free())
+        {
+            throw std::runtime_error("SharedBPlusTree requires lock free 64-bit atomics");
+        }
+        segment->key_size = sizeof(key_type);
+        segment->node_order = order;
+        segment->slot_size = slot_size;
+        segment->bytes = bytes;
+        segment->sequence.store(0u, std::memory_order_relaxed);
+        segment->header = first_slot;
+        segment->top = first_slot + slot_size;
+        tree.reset();
+
+        // the magic goes last, so the segment isn't recognized half written
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(segment->magic, segment_magic, sizeof(segment_magic));
+        return tree;
+    }
+
+    // map an existing segment, for reading only unless writable; throw std::runtime_error
+    // if another handle writes the segment, or a writer died while it modified the tree
+    static SharedBPlusTree open(const std::string& path, bool writable = false, const Compare& keycomp = Compare())
+    {
+        SharedBPlusTree tree(keycomp);
+        tree.m_fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        struct stat status;
+        if (tree.m_fd < 0 || ::fstat(tree.m_fd, &status) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        }
+        if (static_cast<size_type>(status.st_size) < first_slot + slot_size)
+        {
+            throw std::invalid_argument("not a SharedBPlusTree segment: " + path);
+        }
+        tree.map(static_cast<size_type>(status.st_size), writable);
+
+        const Segment* segment = tree.segment();
+        if (std::memcmp(segment->magic, segment_magic, sizeof(segment_magic)) != 0
+            || segment->bytes != tree.m_bytes)
+        {
+            throw std::invalid_argument("not a SharedBPlusTree segment: " + path);
+        }
+        if (segment->key_size != sizeof(key_type) || segment->node_order != order || segment->slot_size != slot_size)
+        {
+            throw std::invalid_argument("SharedBPlusTree segment of another key type or order: " + path);
+        }
+        if (writable)
+        {
+            tree.lock_writer(path);
+            if ((segment->sequence.load(std::memory_order_acquire) & 1u) != 0)
+            {
+                throw std::runtime_error("SharedBPlusTree segment left mid-update by a writer that died: " + path);
+            }
+        }
+        return tree;
+    }
+
+    SharedBPlusTree(SharedBPlusTree&& ano) noexcept
+        : m_keycomp(ano.m_keycomp), m_base(ano.m_base), m_bytes(ano.m_bytes), m_fd(ano.m_fd), m_writable(ano.m_writable)
+    {
+        ano.m_base = nullptr;
+        ano.m_fd = -1;
+    }
+
+    SharedBPlusTree& operator=(SharedBPlusTree&& ano) noexcept
+    {
+        if (this != &ano)
+        {
+            unmap();
+            m_keycomp = ano.m_keycomp;
+            m_base = ano.m_base;
+            m_bytes = ano.m_bytes;
+            m_fd = ano.m_fd;
+            m_writable = ano.m_writable;
+            ano.m_base = nullptr;
+            ano.m_fd = -1;
+        }
+        return *this;
+    }
+
+    SharedBPlusTree(const SharedBPlusTree&) = delete;
+    SharedBPlusTree& operator=(const SharedBPlusTree&) = delete;
+
+    ~SharedBPlusTree()
+    {
+        unmap();
+    }
+
+    // --------------- writer ---------------
+
+    // return false if key exists; throw std::bad_alloc if the segment may run out of slots
+    bool insert(const key_type& key)
+    {
+        check_writable();
+        Segment* seg = segment();
+
+        // a split per layer and a new root at most, allocated before anything is changed
+        if (available_slots() < seg->height + 1)
+        {
+            throw std::bad_alloc();
+        }
+
+        if (seg->root == 0)
+        {
+            begin_write();
+            const offset_type leaf = allocate(true);
+            node(leaf)->keys[0] = key;
+            node(leaf)->count = 1;
+            node(leaf)->next = node(leaf)->pre = seg->header;
+            header()->next = header()->pre = leaf;
+            seg->root = leaf;
+            seg->height = 1;
+            seg->size = 1;
+            end_write();
+            return true;
+        }
+
+        offset_type offset = seg->root;
+        while (!node(offset)->is_leaf)
+        {
+            const Node* inner = node(offset);
+            // a key above the maximum goes to the last child
+            offset = inner->children[std::min(lower_index(inner, key), size_type(inner->count - 1))];
+        }
+
+        Node* leaf = node(offset);
+        const size_type index = lower_index(leaf, key);
+        if (index < leaf->count && !m_keycomp(key, leaf->keys[index]))
+        {
+            return false;
+        }
+
+        begin_write();
+        raise_maximum(offset, key);
+        insert_at(leaf, index, key, 0);
+        seg->size++;
+        if (leaf->count > order)
+        {
+            split(offset);
+        }
+        end_write();
+        return true;
+    }
+
+    size_type erase(const key_type& key)
+    {
+        check_writable();
+        Segment* seg = segment();
+        if (seg->root == 0)
+        {
+            return 0;
+        }
+
+        offset_type offset = seg->root;
+        while (!node(offset)->is_leaf)
+        {
+            const Node* inner = node(offset);
+            const size_type index = lower_index(inner, key);
+            if (index == inner->count)
+            {
+                return 0;
+            }
+            offset = inner->children[index];
+        }
+
+        Node* leaf = node(offset);
+        const size_type index = lower_index(leaf, key);
+        if (index == leaf->count || m_keycomp(key, leaf->keys[index]))
+        {
+            return 0;
+        }
+
+        begin_write();
+        erase_at(leaf, index);
+        seg->size--;
+        if (leaf->count == 0)
+        {
+            remove_node(offset);
+        }
+        end_write();
+        return 1;
+    }
+
+    void clear()
+    {
+        check_writable();
+        begin_write();
+        reset();
+        end_write();
+    }
+
+    // --------------- reader ---------------
+
+    bool contains(const key_type& key) const
+    {
+        bool found = false;
+        read_consistent([&]()
+        {
+            found = false;
+            Node current;
+            size_type index = 0;
+            return descend(key, current, index, found);
+        });
+        return found;
+    }
+
+    // copy the keys in [lo, hi] to out in order, all from the same version of the tree
+    template <typename OutputIt>
+    OutputIt copy_range(const key_type& lo, const key_type& hi, OutputIt out) const
+    {
+        std::vector<key_type> keys;
+        read_consistent([&]()
+        {
+            keys.clear();
+            Node current;
+            size_type index = 0;
+            bool found = false;
+            if (!descend(lo, current, index, found))
+            {
+                return false;
+            }
+            return current.count == 0 || collect(current, index, &hi, keys);
+        });
+        return std::copy(keys.begin(), keys.end(), out);
+    }
+
+    // copy all keys to out in order, all from the same version of the tree
+    template <typename OutputIt>
+    OutputIt copy_all(OutputIt out) const
+    {
+        std::vector<key_type> keys;
+        read_consistent([&]()
+        {
+            keys.clear();
+            const Segment* seg = segment();
+            if (seg->root == 0)
+            {
+                return true;
+            }
+            Node current;
+            return load_node(node(seg->header)->next, current) && collect(current, 0, nullptr, keys);
+        });
+        return std::copy(keys.begin(), keys.end(), out);
+    }
+
+    size_type size() const
+    {
+        size_type res = 0;
+        read_consistent([&]()
+        {
+            res = static_cast<size_type>(segment()->size);
+            return true;
+        });
+        return res;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // even number which changes with every modification of the tree
+    std::uint64_t version() const
+    {
+        std::uint64_t res = 0;
+        for (size_type retries = 1; ((res = segment()->sequence.load(std::memory_order_acquire)) & 1u) != 0; retries++)
+        {
+            check_stuck(res, retries);
+            std::this_thread::yield();
+        }
+        return res;
+    }
+
+    // ------------------------------------------------
+
+    // bytes of the segment, shared by all processes which map it
+    size_type segment_bytes() const
+    {
+        return m_bytes;
+    }
+
+    // node slots that can still be allocated
+    size_type available_slots() const
+    {
+        const Segment* seg = segment();
+        return static_cast<size_type>(seg->free_slots + (m_bytes - seg->top) / slot_size);
+    }
+
+    bool writable() const
+    {
+        return m_writable;
+    }
+
+private:
+    explicit SharedBPlusTree(const Compare& keycomp)
+        : m_keycomp(keycomp)
+    {
+    }
+
+    void map(size_type bytes, bool writable)
+    {
+        void* address = ::mmap(nullptr, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_fd, 0);
+        if (address == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        }
+        m_base = static_cast<unsigned char*>(address);
+        m_bytes = bytes;
+        m_writable = writable;
+    }
+
+    void unmap()
+    {
+        if (m_base != nullptr)
+        {
+            ::munmap(m_base, m_bytes);
+            m_base = nullptr;
+        }
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    void check_writable() const
+    {
+        if (!m_writable)
+        {
+            throw std::logic_error("modify a SharedBPlusTree opened for reading");
+        }
+    }
+
+    Segment* segment()
+    {
+        return reinterpret_cast<Segment*>(m_base);
+    }
+
+    const Segment* segment() const
+    {
+        return reinterpret_cast<const Segment*>(m_base);
+    }
+
+    Node* node(offset_type offset)
+    {
+        return reinterpret_cast<Node*>(m_base + offset);
+    }
+
+    const Node* node(offset_type offset) const
+    {
+        return reinterpret_cast<const Node*>(m_base + offset);
+    }
+
+    Node* header()
+    {
+        return node(segment()->header);
+    }
+
+    // --------------- seqlock ---------------
+
+    void begin_write()
+    {
+        Segment* seg = segment();
+        seg->sequence.store(seg->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_write()
+    {
+        Segment* seg = segment();
+        seg->sequence.store(seg->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // run read until it ran while no write was in progress; read returns false if it saw
+    // an inconsistent tree, which only a concurrent write explains
+    template <typename Read>
+    void read_consistent(Read read) const
+    {
+        const Segment* seg = segment();
+        for (size_type retries = 1; ; retries++)
+        {
+            const std::uint64_t sequence = seg->sequence.load(std::memory_order_acquire);
+            if ((sequence & 1u) != 0)
+            {
+                check_stuck(sequence, retries);
+            }
+            else
+            {
+                const bool consistent = read();
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seg->sequence.load(std::memory_order_relaxed) == sequence)
+                {
+                    if (!consistent)
+                    {
+                        throw std::runtime_error("SharedBPlusTree segment is corrupted");
+                    }
+                    return;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // An odd sequence number that stays put after stuck_retries retries either belongs to a
+    // long write, or to a writer which died in the middle of one; its lock tells them apart.
+    void check_stuck(std::uint64_t sequence, size_type retries) const
+    {
+        if (retries % stuck_retries == 0 && !writer_alive()
+            && segment()->sequence.load(std::memory_order_acquire) == sequence)
+        {
+            throw std::runtime_error("SharedBPlusTree writer died in the middle of a modification");
+        }
+    }
+
+    // --------------- writer lock ---------------
+
+    // A writable handle holds a write lock on the first byte of the file until it's closed.
+    // It's an open file description lock, so the kernel drops it when the process dies, and
+    // a reader handle in the writer's own process still sees it.
+    static struct flock writer_lock_request(short type)
+    {
+        struct flock request;
+        std::memset(&request, 0, sizeof(request));
+        request.l_type = type;
+        request.l_whence = SEEK_SET;
+        request.l_start = 0;
+        request.l_len = 1;
+        return request;
+    }
+
+    void lock_writer(const std::string& path)
+    {
+        struct flock request = writer_lock_request(F_WRLCK);
+        if (::fcntl(m_fd, writer_lock_set, &request) != 0)
+        {
+            if (errno == EAGAIN || errno == EACCES)
+            {
+                throw std::runtime_error("SharedBPlusTree segment has another writer: " + path);
+            }
+            throw std::system_error(errno, std::generic_category(), "lock " + path);
+        }
+    }
+
+    bool writer_alive() const
+    {
+        struct flock request = writer_lock_request(F_WRLCK);
+        if (::fcntl(m_fd, writer_lock_get, &request) != 0)
+        {
+            // can't tell, keep waiting
+            return true;
+        }
+        return request.l_type != F_UNLCK;
+    }
+
+    bool valid_offset(offset_type offset) const
+    {
+        return offset >= first_slot + slot_size && offset <= m_bytes - slot_size
+            && (offset - first_slot) % slot_size == 0;
+    }
+
+    // copy the used part of a node out of the segment, false if it can't be a node
+    bool load_node(offset_type offset, Node& copy) const
+    {
+        if (!valid_offset(offset))
+        {
+            return false;
+        }
+        const Node* source = node(offset);
+        copy.parent = source->parent;
+        copy.next = source->next;
+        copy.pre = source->pre;
+        copy.count = source->count;
+        copy.is_leaf = source->is_leaf;
+        if (copy.count == 0 || copy.count > order)
+        {
+            return false;
+        }
+        std::memcpy(copy.keys, source->keys, copy.count * sizeof(key_type));
+        if (!copy.is_leaf)
+        {
+            std::memcpy(copy.children, source->children, copy.count * sizeof(offset_type));
+        }
+        return true;
+    }
+
+    // copy of the leaf which may hold key and the position of the first key not less than
+    // key in it; current.count is 0 if all keys are less than key
+    bool descend(const key_type& key, Node& current, size_type& index, bool& found) const
+    {
+        const Segment* seg = segment();
+        const std::uint64_t height = seg->height;
+        offset_type offset = seg->root;
+        current.count = 0;
+        if (offset == 0)
+        {
+            return true;
+        }
+
+        for (std::uint64_t depth = 0; depth < height; depth++)
+        {
+            if (!load_node(offset, current))
+            {
+                return false;
+            }
+            index = static_cast<size_type>(std::lower_bound(current.keys, current.keys + current.count, key, m_keycomp) - current.keys);
+            if (!current.is_leaf)
+            {
+                // the separators may be stale, a key above all of them is at the end of the last child
+                offset = current.children[std::min(index, size_type(current.count - 1))];
+                continue;
+            }
+
+            found = index < current.count && !m_keycomp(key, current.keys[index]);
+            if (index < current.count)
+            {
+                return true;
+            }
+
+            // all keys of the leaf are less than key, continue at the start of the next one
+            index = 0;
+            const offset_type next = current.next;
+            current.count = 0;
+            return next == seg->header || load_node(next, current);
+        }
+        return false;
+    }
+
+    // append the keys of the leaves from current[index] on, up to *hi if hi isn't null
+    bool collect(Node& current, size_type index, const key_type* hi, std::vector<key_type>& keys) const
+    {
+        const Segment* seg = segment();
+        const size_type limit = static_cast<size_type>(seg->size);
+        while (true)
+        {
+            for (; index < current.count; index++)
+            {
+                if (hi != nullptr && m_keycomp(*hi, current.keys[index]))
+                {
+                    return true;
+                }
+                if (keys.size() == limit)
+                {
+                    return false;
+                }
+                keys.push_back(current.keys[index]);
+            }
+            if (current.next == seg->header)
+            {
+                return true;
+            }
+            if (!load_node(current.next, current) || !current.is_leaf)
+            {
+                return false;
+            }
+            index = 0;
+        }
+    }
+
+    // --------------- node operations of the writer ---------------
+
+    void reset()
+    {
+        Segment* seg = segment();
+        seg->root = 0;
+        seg->size = 0;
+        seg->height = 0;
+        seg->free_list = 0;
+        seg->free_slots = 0;
+        seg->top = first_slot + slot_size;
+
+        Node* sentinel = header();
+        sentinel->parent = 0;
+        sentinel->next = sentinel->pre = seg->header;
+        sentinel->count = 0;
+        sentinel->is_leaf = true;
+    }
+
+    offset_type allocate(bool is_leaf)
+    {
+        Segment* seg = segment();
+        offset_type offset = seg->free_list;
+        if (offset != 0)
+        {
+            seg->free_list = node(offset)->next;
+            seg->free_slots--;
+        }
+        else
+        {
+            if (seg->top + slot_size > m_bytes)
+            {
+                throw std::bad_alloc();
+            }
+            offset = seg->top;
+            seg->top += slot_size;
+        }
+
+        Node* res = node(offset);
+        res->parent = res->next = res->pre = 0;
+        res->count = 0;
+        res->is_leaf = is_leaf;
+        return offset;
+    }
+
+    void free_node(offset_type offset)
+    {
+        Segment* seg = segment();
+        Node* freed = node(offset);
+        freed->count = 0;
+        freed->next = seg->free_list;
+        seg->free_list = offset;
+        seg->free_slots++;
+    }
+
+    size_type lower_index(const Node* current, const key_type& key) const
+    {
+        return static_cast<size_type>(std::lower_bound(current->keys, current->keys + current->count, key, m_keycomp) - current->keys);
+    }
+
+    static size_type child_index(const Node* parent, offset_type child)
+    {
+        return static_cast<size_type>(std::find(parent->children, parent->children + parent->count, child) - parent->children);
+    }
+
+    void insert_at(Node* current, size_type index, const key_type& key, offset_type child)
+    {
+        std::copy_backward(current->keys + index, current->keys + current->count, current->keys + current->count + 1);
+        std::copy_backward(current->children + index, current->children + current->count, current->children + current->count + 1);
+        current->keys[index] = key;
+        current->children[index] = child;
+        current->count++;
+    }
+
+    void erase_at(Node* current, size_type index)
+    {
+        std::copy(current->keys + index + 1, current->keys + current->count, current->keys + index);
+        std::copy(current->children + index + 1, current->children + current->count, current->children + index);
+        current->count--;
+    }
+
+    // key is inserted below offset, raise the maxima of the ancestors below it
+    void raise_maximum(offset_type offset, const key_type& key)
+    {
+        for (offset_type parent = node(offset)->parent; parent != 0; offset = parent, parent = node(parent)->parent)
+        {
+            Node* current = node(parent);
+            const size_type index = child_index(current, offset);
+            if (!m_keycomp(current->keys[index], key))
+            {
+                break;
+            }
+            current->keys[index] = key;
+        }
+    }
+
+    // move the lower half of an overflowed node into a new left slibing
+    void split(offset_type offset)
+    {
+        Segment* seg = segment();
+        const offset_type left_offset = allocate(node(offset)->is_leaf);
+        Node* right = node(offset);
+        Node* left = node(left_offset);
+
+        const size_type half = right->count / 2;
+        std::copy(right->keys, right->keys + half, left->keys);
+        std::copy(right->children, right->children + half, left->children);
+        left->count = static_cast<std::uint32_t>(half);
+        for (size_type i = 0; i < half; i++)
+        {
+            erase_at(right, 0);
+        }
+        if (!left->is_leaf)
+        {
+            for (size_type i = 0; i < half; i++)
+            {
+                node(left->children[i])->parent = left_offset;
+            }
+        }
+
+        left->pre = right->pre;
+        left->next = offset;
+        if (left->pre != 0)
+        {
+            node(left->pre)->next = left_offset;
+        }
+        right->pre = left_offset;
+
+        if (right->parent == 0)
+        {
+            const offset_type root = allocate(false);
+            Node* parent = node(root);
+            parent->keys[0] = left->keys[left->count - 1];
+            parent->children[0] = left_offset;
+            parent->keys[1] = right->keys[right->count - 1];
+            parent->children[1] = offset;
+            parent->count = 2;
+            left->parent = right->parent = root;
+            seg->root = root;
+            seg->height++;
+            return;
+        }
+
+        Node* parent = node(right->parent);
+        left->parent = right->parent;
+        insert_at(parent, child_index(parent, offset), left->keys[left->count - 1], left_offset);
+        if (parent->count > order)
+        {
+            split(right->parent);
+        }
+    }
+
+    // unlink an empty node, remove its record from the parent, collapse a root with one child
+    void remove_node(offset_type offset)
+    {
+        Segment* seg = segment();
+        Node* current = node(offset);
+        if (current->pre != 0)
+        {
+            node(current->pre)->next = current->next;
+        }
+        if (current->next != 0)
+        {
+            node(current->next)->pre = current->pre;
+        }
+
+        const offset_type parent_offset = current->parent;
+        free_node(offset);
+        if (parent_offset == 0)
+        {
+            seg->root = 0;
+            seg->height = 0;
+            return;
+        }
+
+        Node* parent = node(parent_offset);
+        erase_at(parent, child_index(parent, offset));
+        if (parent->count == 0)
+        {
+            remove_node(parent_offset);
+            return;
+        }
+
+        while (!node(seg->root)->is_leaf && node(seg->root)->count == 1)
+        {
+            const offset_type root = seg->root;
+            seg->root = node(root)->children[0];
+            node(seg->root)->parent = 0;
+            seg->height--;
+            free_node(root);
+        }
+    }
+
+private:
+    Compare m_keycomp;
+    unsigned char* m_base = nullptr;
+    size_type m_bytes = 0u;
+    int m_fd = -1;
+    bool m_writable = false;
+};
+
+template <typename T, std::size_t order, typename Compare>
+constexpr char SharedBPlusTree<T, order, Compare>::segment_magic[8];
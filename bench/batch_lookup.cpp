@@ -0,0 +1,56 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Look up 2M random keys in trees too large for the caches, one at a time with
+// find and in interleaved groups with contains_batch.
+
+int main()
+{
+    std::mt19937_64 rng(27);
+    for (long n : { 100000L, 1000000L, 10000000L })
+    {
+        std::vector<long> keys(n);
+        for (long i = 0; i < n; i++)
+        {
+            keys[i] = i * 4 + long(rng() % 4);
+        }
+        BPlusTree<long, 64> tree;
+        for (long key : keys)
+        {
+            tree.insert(key);
+        }
+
+        std::vector<long> probes(2000000);
+        for (auto& probe : probes)
+        {
+            probe = long(rng() % (4 * n));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t found = 0;
+        for (long probe : probes)
+        {
+            found += tree.find(probe) != tree.end();
+        }
+        auto middle = std::chrono::steady_clock::now();
+        std::vector<bool> contained;
+        contained.reserve(probes.size());
+        tree.contains_batch(probes.begin(), probes.end(), std::back_inserter(contained));
+        auto stop = std::chrono::steady_clock::now();
+
+        size_t found_batch = 0;
+        for (bool value : contained)
+        {
+            found_batch += value;
+        }
+        std::cout << n << " keys: find " << std::chrono::duration<double, std::nano>(middle - start).count() / probes.size()
+                  << " ns, contains_batch " << std::chrono::duration<double, std::nano>(stop - middle).count() / probes.size()
+                  << " ns per key (" << found << " / " << found_batch << " found)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Look up 2M keys, 90% of them absent, in trees without and with filters of growing bits
+// per key.
+
+int main()
+{
+    std::mt19937_64 rng(37);
+    for (long n : { 1000000L, 10000000L })
+    {
+        BPlusTree<long, 64> tree;
+        for (long i = 0; i < n; i++)
+        {
+            tree.insert(i * 10);
+        }
+
+        std::vector<long> probes(2000000);
+        for (auto& probe : probes)
+        {
+            probe = long(rng() % (n * 10));
+        }
+
+        std::cout << n << " keys:";
+        for (size_t bits : { 0u, 4u, 8u, 12u })
+        {
+            tree.set_bloom_filter(bits);
+            size_t found = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (long probe : probes)
+            {
+                found += tree.contains(probe);
+            }
+            const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / probes.size();
+            std::cout << " " << bits << " bits " << ns << " ns (" << tree.memory_footprint().filter_bytes << " bytes, "
+                      << found << " found),";
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+
+#include "BPlusTree.h"
+
+// Erase random keys out of 1M under FREE_AT_EMPTY, which leaves sparse leaves behind, then
+// compact them with shrink_to_fit and with compact_step and report the bytes and the leaf fill.
+
+using Tree = BPlusTree<long, 64>;
+
+void make_sparse_tree(Tree& tree)
+{
+    std::mt19937_64 rng(30);
+    tree.set_erase_policy(Tree::ErasePolicy::FREE_AT_EMPTY);
+    for (long i = 0; i < 1000000; i++)
+    {
+        tree.insert(i);
+    }
+    for (long i = 0; i < 2000000; i++)
+    {
+        tree.erase(long(rng() % 1000000));
+    }
+}
+
+void report(const char* name, const Tree& tree, double ms)
+{
+    const auto footprint = tree.memory_footprint();
+    std::cout << name << footprint.total() << " bytes, " << footprint.leaf_count << " leaves, fill "
+              << footprint.leaf_fill() << ", " << ms << " ms" << std::endl;
+}
+
+int main()
+{
+    Tree tree;
+    make_sparse_tree(tree);
+    report("sparse:          ", tree, 0.0);
+
+    auto start = std::chrono::steady_clock::now();
+    tree.shrink_to_fit();
+    report("shrink_to_fit:   ", tree, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    Tree stepped;
+    make_sparse_tree(stepped);
+    start = std::chrono::steady_clock::now();
+    while (!stepped.compact_step(64))
+    {
+    }
+    report("compact_step 64: ", stepped, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Erase every other key of 4M, by erase(key) one at a time and by one erase_if sweep.
+
+int main()
+{
+    const long n = 4000000;
+    std::vector<long> keys(n);
+    for (long i = 0; i < n; i++)
+    {
+        keys[i] = i;
+    }
+
+    BPlusTree<long, 64> by_key, by_sweep;
+    for (long key : keys)
+    {
+        by_key.insert(key);
+        by_sweep.insert(key);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < n; i += 2)
+    {
+        by_key.erase(i);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    erase_if(by_sweep, [](long key) { return key % 2 == 0; });
+    auto stop = std::chrono::steady_clock::now();
+
+    std::cout << "erase(key) " << std::chrono::duration<double, std::milli>(middle - start).count()
+              << " ms, erase_if " << std::chrono::duration<double, std::milli>(stop - middle).count()
+              << " ms (" << by_key.size() << " / " << by_sweep.size() << " left)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+
+#include "BPlusTree.h"
+
+// Alternate random inserts and erases on 1M keys under each erase policy, and report the
+// time and the leaf fill left behind.
+
+using Tree = BPlusTree<long, 64>;
+
+void run(const char* name, Tree::ErasePolicy policy, size_t min_fill)
+{
+    Tree tree;
+    for (long i = 0; i < 1000000; i++)
+    {
+        tree.insert(i * 2);
+    }
+    tree.set_erase_policy(policy, min_fill);
+
+    std::mt19937_64 rng(32);
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < 4000000; i++)
+    {
+        const long key = long(rng() % 2000000);
+        if (i % 3 == 0)
+        {
+            tree.insert(key);
+        }
+        else
+        {
+            tree.erase(key);
+        }
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << ms << " ms, fill " << tree.memory_footprint().leaf_fill() << ", " << tree.size() << " keys" << std::endl;
+}
+
+int main()
+{
+    run("EAGER:           ", Tree::ErasePolicy::EAGER, 1u);
+    run("MIN_FILL 8:      ", Tree::ErasePolicy::MIN_FILL, 8u);
+    run("FREE_AT_EMPTY:   ", Tree::ErasePolicy::FREE_AT_EMPTY, 1u);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Look up 2M random keys in a tree and in its frozen and packed copies, and compare their bytes.
+
+template <typename Lookup>
+double nanoseconds_per_probe(const std::vector<long>& probes, Lookup lookup, size_t& found)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (long probe : probes)
+    {
+        found += lookup(probe);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / probes.size();
+}
+
+int main()
+{
+    std::mt19937_64 rng(29);
+    for (long n : { 100000L, 1000000L, 10000000L })
+    {
+        std::vector<long> keys(n);
+        for (long i = 0; i < n; i++)
+        {
+            keys[i] = i * 3 + long(rng() % 3);
+        }
+        BPlusTree<long, 64> tree;
+        for (long key : keys)
+        {
+            tree.insert(key);
+        }
+        const auto frozen = tree.freeze();
+        const auto packed = tree.freeze_packed();
+
+        std::vector<long> probes(2000000);
+        for (auto& probe : probes)
+        {
+            probe = long(rng() % (3 * n));
+        }
+
+        size_t found = 0;
+        const double tree_ns = nanoseconds_per_probe(probes, [&](long key) { return tree.contains(key); }, found);
+        const double frozen_ns = nanoseconds_per_probe(probes, [&](long key) { return frozen.contains(key); }, found);
+        const double packed_ns = nanoseconds_per_probe(probes, [&](long key) { return packed.contains(key); }, found);
+        std::cout << n << " keys: tree " << tree_ns << " ns " << tree.memory_footprint().total() << " bytes, frozen "
+                  << frozen_ns << " ns " << frozen.memory_footprint() << " bytes, packed "
+                  << packed_ns << " ns " << packed.memory_footprint() << " bytes (" << found << " found)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "BPlusTree.h"
+#include "KeyEncoding.h"
+
+// Insert 1M composite keys (uint32, string, int64) and find 2M of them, as tuples compared
+// field by field, as encoded std::string keys and as NormalizedKey<32>.
+
+using Fields = std::tuple<std::uint32_t, std::string, std::int64_t>;
+
+template <typename Tree, typename Make>
+void run(const char* name, const std::vector<Fields>& fields, const std::vector<size_t>& probes, Make make)
+{
+    std::vector<typename Tree::key_type> keys;
+    keys.reserve(fields.size());
+    for (const auto& field : fields)
+    {
+        keys.push_back(make(field));
+    }
+
+    Tree tree;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& key : keys)
+    {
+        tree.insert(key);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (size_t probe : probes)
+    {
+        found += tree.find(keys[probe]) != tree.end();
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    std::cout << name << "insert " << std::chrono::duration<double, std::milli>(middle - start).count() << " ms, find "
+              << std::chrono::duration<double, std::nano>(stop - middle).count() / probes.size() << " ns ("
+              << found << " found)" << std::endl;
+}
+
+int main()
+{
+    std::mt19937_64 rng(40);
+    std::vector<Fields> fields(1000000);
+    for (auto& field : fields)
+    {
+        field = Fields(std::uint32_t(rng() % 100), "customer/" + std::to_string(rng() % 100000), std::int64_t(rng() % 1000) - 500);
+    }
+    std::vector<size_t> probes(2000000);
+    for (auto& probe : probes)
+    {
+        probe = size_t(rng() % fields.size());
+    }
+
+    run<BPlusTree<Fields, 64>>("tuple:          ", fields, probes, [](const Fields& field) { return field; });
+    run<BPlusTree<std::string, 64>>("encoded string: ", fields, probes,
+        [](const Fields& field) { return KeyEncoding::encode(field); });
+    run<BPlusTree<NormalizedKey<32>, 64>>("NormalizedKey:  ", fields, probes,
+        [](const Fields& field) { return NormalizedKey<32>(KeyEncoding::encode(field)); });
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Sum the keys of a tree of 4M keys with the iterators and with scan, over the whole tree
+// in both directions and over 20k short ranges. One tree is built from sorted keys, its
+// leaves lie in allocation order; the other by random inserts, its leaves are scattered.
+
+using Tree = BPlusTree<long, 64>;
+
+double ms_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void run(const char* name, Tree& tree, long n)
+{
+    auto add = [](long& sum)
+    {
+        return [&sum](Tree::leaf_record_iterator first, Tree::leaf_record_iterator last)
+        {
+            for (; first != last; ++first)
+            {
+                sum += first->first;
+            }
+        };
+    };
+
+    long iterated = 0, scanned = 0, iterated_reverse = 0, scanned_reverse = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto iter = tree.begin(), end = tree.end(); iter != end; ++iter)
+    {
+        iterated += *iter;
+    }
+    const double iterator_ms = ms_since(start);
+    start = std::chrono::steady_clock::now();
+    tree.scan(add(scanned));
+    const double scan_ms = ms_since(start);
+    start = std::chrono::steady_clock::now();
+    for (auto iter = tree.end(), begin = tree.begin(); iter != begin; )
+    {
+        --iter;
+        iterated_reverse += *iter;
+    }
+    const double iterator_reverse_ms = ms_since(start);
+    start = std::chrono::steady_clock::now();
+    tree.scan(add(scanned_reverse), true);
+    const double scan_reverse_ms = ms_since(start);
+
+    std::cout << name << " full: iterator " << iterator_ms << " ms, scan " << scan_ms
+              << " ms; reverse iterator " << iterator_reverse_ms << " ms, reverse scan " << scan_reverse_ms
+              << " ms (sums " << (iterated == scanned && iterated_reverse == scanned_reverse ? "equal" : "differ") << ")" << std::endl;
+
+    for (long length : { 10L, 100L, 1000L })
+    {
+        std::mt19937_64 rng(45);
+        std::vector<long> los(20000);
+        for (auto& lo : los)
+        {
+            lo = long(rng() % (n * 3));
+        }
+
+        long iterated_ranges = 0, scanned_ranges = 0;
+        start = std::chrono::steady_clock::now();
+        for (long lo : los)
+        {
+            const long hi = lo + length * 3;
+            for (auto iter = tree.lower_bound(lo), end = tree.end(); iter != end && *iter <= hi; ++iter)
+            {
+                iterated_ranges += *iter;
+            }
+        }
+        const double ranges_iterator_ms = ms_since(start);
+        start = std::chrono::steady_clock::now();
+        for (long lo : los)
+        {
+            tree.scan(lo, lo + length * 3, add(scanned_ranges));
+        }
+        const double ranges_scan_ms = ms_since(start);
+
+        std::cout << name << " 20k ranges of " << length << " keys: iterator " << ranges_iterator_ms << " ms, scan "
+                  << ranges_scan_ms << " ms (sums " << (iterated_ranges == scanned_ranges ? "equal" : "differ") << ")" << std::endl;
+    }
+}
+
+int main()
+{
+    const long n = 4000000;
+    std::vector<long> keys(n);
+    for (long i = 0; i < n; i++)
+    {
+        keys[i] = i * 3;
+    }
+    Tree sorted = Tree::build_parallel(keys.begin(), keys.end(), 1);
+    run("sorted", sorted, n);
+
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(45));
+    Tree shuffled;
+    for (long key : keys)
+    {
+        shuffled.insert(key);
+    }
+    run("random", shuffled, n);
+    return 0;
+}
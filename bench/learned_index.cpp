@@ -0,0 +1,46 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Look up 2M random keys in a read-mostly tree of random keys, through the inner nodes and
+// through learned indexes of growing epsilon.
+
+int main()
+{
+    std::mt19937_64 rng(36);
+    for (long n : { 1000000L, 10000000L })
+    {
+        BPlusTree<long, 64> tree;
+        for (long i = 0; i < n; i++)
+        {
+            tree.insert(long(rng() % (n * 8)));
+        }
+
+        std::vector<long> probes(2000000);
+        for (auto& probe : probes)
+        {
+            probe = long(rng() % (n * 8));
+        }
+
+        std::cout << n << " keys:";
+        for (size_t epsilon : { 0u, 4u, 16u, 64u })
+        {
+            tree.set_learned_index(epsilon);
+            size_t found = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (long probe : probes)
+            {
+                found += tree.find(probe) != tree.end();
+            }
+            const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / probes.size();
+            std::cout << " epsilon " << epsilon << " " << ns << " ns (" << tree.learned_segments() << " segments, "
+                      << tree.memory_footprint().learned_bytes << " bytes, " << found << " found),";
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Find 4M keys drawn from a Zipf-like distribution (rank r with weight 1 / r) over 10M
+// keys, without and with lookup caches of growing size.
+
+int main()
+{
+    const long n = 10000000;
+    BPlusTree<long, 64> tree;
+    for (long i = 0; i < n; i++)
+    {
+        tree.insert(i * 2);
+    }
+
+    // rank = n ^ u is 1 / r distributed for a uniform u, scattered over the key range
+    std::mt19937_64 rng(38);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<long> probes(4000000);
+    for (auto& probe : probes)
+    {
+        const long rank = long(std::pow(double(n), uniform(rng))) - 1;
+        probe = (rank * 2654435761L % n) * 2;
+    }
+
+    for (size_t entries : { 0u, 1024u, 16384u, 262144u })
+    {
+        tree.set_lookup_cache(entries);
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long probe : probes)
+        {
+            found += tree.find(probe) != tree.end();
+        }
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / probes.size();
+        std::cout << "cache " << entries << ": " << ns << " ns, hit rate " << tree.cache_stats().hit_rate()
+                  << " (" << found << " found)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Diff two replicas of 1M keys which differ in a growing number of keys, against a full
+// merge of their keys.
+
+using Tree = BPlusTree<long, 64, std::less<long>, MerkleAggregate<long>>;
+
+int main()
+{
+    const long n = 1000000;
+    std::vector<long> keys(n);
+    for (long i = 0; i < n; i++)
+    {
+        keys[i] = i * 2;
+    }
+
+    std::mt19937_64 rng(39);
+    for (long changes : { 1L, 10L, 100L, 1000L, 10000L })
+    {
+        Tree lhs, rhs;
+        for (long key : keys)
+        {
+            lhs.insert(key);
+            rhs.insert(key);
+        }
+        for (long i = 0; i < changes; i++)
+        {
+            rhs.insert(long(rng() % n) * 2 + 1);
+        }
+
+        std::vector<std::pair<long, bool>> differences;
+        auto start = std::chrono::steady_clock::now();
+        lhs.diff(rhs, std::back_inserter(differences));
+        auto middle = std::chrono::steady_clock::now();
+        size_t merged = 0;
+        for (auto lhs_iter = lhs.begin(), rhs_iter = rhs.begin(); lhs_iter != lhs.end() || rhs_iter != rhs.end(); )
+        {
+            if (rhs_iter == rhs.end() || (lhs_iter != lhs.end() && *lhs_iter < *rhs_iter))
+            {
+                ++lhs_iter;
+                merged++;
+            }
+            else if (lhs_iter == lhs.end() || *rhs_iter < *lhs_iter)
+            {
+                ++rhs_iter;
+                merged++;
+            }
+            else
+            {
+                ++lhs_iter;
+                ++rhs_iter;
+            }
+        }
+        auto stop = std::chrono::steady_clock::now();
+
+        std::cout << changes << " changes: diff " << std::chrono::duration<double, std::milli>(middle - start).count()
+                  << " ms, full merge " << std::chrono::duration<double, std::milli>(stop - middle).count() << " ms ("
+                  << differences.size() << " / " << merged << " differences)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// Build a tree of 4M random keys by inserts and by build_parallel on a growing number of
+// workers.
+
+using Tree = BPlusTree<long, 64>;
+
+int main()
+{
+    const size_t n = 4000000;
+    std::mt19937_64 rng(43);
+    std::vector<long> input(n);
+    for (auto& key : input)
+    {
+        key = long(rng() % (n * 4));
+    }
+    std::cout << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    size_t size;
+    {
+        Tree tree;
+        for (long key : input)
+        {
+            tree.insert(key);
+        }
+        size = tree.size();
+    }
+    const double serial = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "inserts: " << serial << " ms, " << size << " keys" << std::endl;
+
+    for (size_t threads : { 1, 2, 4, 8, 16 })
+    {
+        start = std::chrono::steady_clock::now();
+        size = Tree::build_parallel(input.begin(), input.end(), threads).size();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "build_parallel " << threads << " workers: " << ms << " ms, " << serial / ms << "x, " << size << " keys" << std::endl;
+    }
+    return 0;
+}
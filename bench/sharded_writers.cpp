@@ -0,0 +1,58 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "ShardedBPlusTree.h"
+
+// 2M random inserts split over 1 to 64 writer threads, into one BPlusTree behind a mutex
+// and into a ShardedBPlusTree with a shard per writer.
+
+template <typename Insert>
+double run(size_t writers, size_t total, Insert insert)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < writers; w++)
+    {
+        threads.emplace_back([&, w]()
+        {
+            std::mt19937_64 rng(w);
+            for (size_t i = 0; i < total / writers; i++)
+            {
+                insert(long(rng() % (total * 4)));
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    return double(total) / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+int main()
+{
+    const size_t total = 2000000;
+    std::cout << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    for (size_t writers : { 1, 2, 4, 8, 16, 32, 64 })
+    {
+        BPlusTree<long, 32> tree;
+        std::mutex mutex;
+        const double locked = run(writers, total, [&](long key)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tree.insert(key);
+        });
+
+        ShardedBPlusTree<long, 32> sharded(writers);
+        const double partitioned = run(writers, total, [&](long key) { sharded.insert(key); });
+
+        std::cout << writers << " writers: mutex " << locked << " M inserts/s, sharded " << partitioned
+                  << " M inserts/s (" << sharded.shard_count() << " shards)" << std::endl;
+    }
+    return 0;
+}
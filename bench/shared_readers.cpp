@@ -0,0 +1,90 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "SharedBPlusTree.h"
+
+// Forked readers look up random keys in a segment of 1M keys for one second each while the
+// writer keeps inserting, for a growing number of readers.
+
+using Tree = SharedBPlusTree<long, 32>;
+
+int main()
+{
+    const char* directory = ::access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+    const std::string path = std::string(directory) + "/bplustree_bench_" + std::to_string(::getpid());
+    const long n = 1000000;
+
+    for (int reader_count : { 0, 1, 2, 4, 8 })
+    {
+        Tree writer = Tree::create(path, size_t(1) << 30);
+        for (long i = 0; i < n; i++)
+        {
+            writer.insert(i * 4);
+        }
+
+        int results[2];
+        if (::pipe(results) != 0)
+        {
+            return 1;
+        }
+        std::vector<pid_t> readers;
+        for (int r = 0; r < reader_count; r++)
+        {
+            const pid_t pid = ::fork();
+            if (pid == 0)
+            {
+                Tree reader = Tree::open(path);
+                std::mt19937_64 rng(r);
+                long lookups = 0, found = 0;
+                auto stop = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+                while (std::chrono::steady_clock::now() < stop)
+                {
+                    for (int i = 0; i < 256; i++, lookups++)
+                    {
+                        found += reader.contains(long(rng() % (4 * n)));
+                    }
+                }
+                const long message[2] = { lookups, found };
+                ::_exit(::write(results[1], message, sizeof(message)) == sizeof(message) ? 0 : 1);
+            }
+            readers.push_back(pid);
+        }
+
+        std::mt19937_64 rng(41);
+        long inserts = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+        {
+            for (int i = 0; i < 256; i++, inserts++)
+            {
+                writer.insert(long(rng() % (4 * n)) | 1);
+            }
+        }
+
+        long lookups = 0, found = 0;
+        for (pid_t pid : readers)
+        {
+            long message[2];
+            if (::read(results[0], message, sizeof(message)) == sizeof(message))
+            {
+                lookups += message[0];
+                found += message[1];
+            }
+            ::waitpid(pid, nullptr, 0);
+        }
+        ::close(results[0]);
+        ::close(results[1]);
+        std::cout << reader_count << " readers: " << lookups / 1e6 << " M lookups/s in total (" << found << " found), writer "
+                  << inserts / 1e6 << " M inserts/s" << std::endl;
+    }
+    ::unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+
+#include "BPlusTree.h"
+
+// Split trees of growing size at random keys and join the pieces back, the time per pair
+// grows with the height of the tree only (and with the walk counting the moved keys).
+
+int main()
+{
+    std::mt19937_64 rng(31);
+    for (long n : { 10000L, 100000L, 1000000L, 10000000L })
+    {
+        BPlusTree<long, 64> tree;
+        for (long i = 0; i < n; i++)
+        {
+            tree.insert(i);
+        }
+
+        const int pairs = 1000;
+        double split_ms = 0.0, join_ms = 0.0;
+        for (int i = 0; i < pairs; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto right = tree.split_off(long(rng() % n));
+            auto middle = std::chrono::steady_clock::now();
+            tree.join(std::move(right));
+            auto stop = std::chrono::steady_clock::now();
+            split_ms += std::chrono::duration<double, std::milli>(middle - start).count();
+            join_ms += std::chrono::duration<double, std::milli>(stop - middle).count();
+        }
+        std::cout << n << " keys: split_off " << split_ms * 1000 / pairs << " us, join " << join_ms * 1000 / pairs
+                  << " us (" << tree.size() << " keys)" << std::endl;
+    }
+    return 0;
+}
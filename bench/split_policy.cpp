@@ -0,0 +1,31 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+
+#include "BPlusTree.h"
+
+// Insert 4M ascending keys under each split policy, and report the time, bytes and leaf fill.
+
+using Tree = BPlusTree<long, 64>;
+
+void run(const char* name, Tree::SplitPolicy policy, double skew)
+{
+    Tree tree;
+    tree.set_split_policy(policy, skew);
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < 4000000; i++)
+    {
+        tree.insert(i);
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    const auto footprint = tree.memory_footprint();
+    std::cout << name << ms << " ms, " << footprint.total() << " bytes, fill " << footprint.leaf_fill() << std::endl;
+}
+
+int main()
+{
+    run("EVEN:         ", Tree::SplitPolicy::EVEN, 0.9);
+    run("SKEWED 0.9:   ", Tree::SplitPolicy::SKEWED, 0.9);
+    run("SKEWED 1.0:   ", Tree::SplitPolicy::SKEWED, 1.0);
+    return 0;
+}
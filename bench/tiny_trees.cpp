@@ -0,0 +1,49 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <vector>
+
+#include "BPlusTree.h"
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+#include <malloc.h>
+size_t heap_bytes() { return mallinfo2().uordblks; }
+#else
+size_t heap_bytes() { return 0u; }  // not measured
+#endif
+
+// Build one million trees of a few keys each and report the object size and the heap
+// bytes per tree, with and without the inline keys.
+
+template <typename Tree>
+void run(const char* name, int keys)
+{
+    const size_t before = heap_bytes();
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<Tree> trees(1000000);
+    long key = 0;
+    for (auto& tree : trees)
+    {
+        for (int i = 0; i < keys; i++)
+        {
+            tree.insert((key++ * 2654435761u) % 100000);
+        }
+    }
+
+    auto stop = std::chrono::steady_clock::now();
+    const size_t heap = heap_bytes() - before;
+    std::cout << name << " keys=" << keys << " sizeof=" << sizeof(Tree)
+              << " bytes/tree=" << heap / 1000000.0
+              << " build ms=" << std::chrono::duration<double, std::milli>(stop - start).count() << std::endl;
+}
+
+int main()
+{
+    for (int keys : { 4, 12 })
+    {
+        run<BPlusTree<long, 32>>("plain  ", keys);
+        run<BPlusTree<long, 32, std::less<long>, NoAggregate<long>, 16>>("inline ", keys);
+    }
+    return 0;
+}
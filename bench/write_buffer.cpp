@@ -0,0 +1,99 @@
+#include <iostream>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "BPlusTree.h"
+
+// 1M random inserts into a tree of 1M keys, with a find after every read_every inserts,
+// plain and through write buffers of growing capacity. Then a full traversal with the
+// messages pending: merged at every step through a const tree, flushed by begin().
+
+using Tree = BPlusTree<long, 64>;
+
+double run(size_t capacity, size_t read_every, size_t& found)
+{
+    const size_t n = 1000000;
+    std::mt19937_64 rng(34);
+    Tree tree;
+    for (size_t i = 0; i < n; i++)
+    {
+        tree.insert(long(rng() % (n * 4)));
+    }
+    tree.set_write_buffer(capacity);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++)
+    {
+        tree.buffer_insert(long(rng() % (n * 4)));
+        if (read_every != 0 && i % read_every == 0)
+        {
+            found += tree.find(long(rng() % (n * 4))) != tree.end();
+        }
+    }
+    tree.flush();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// traverse a tree of 1M keys with the buffers holding the last inserts
+template <typename Traverse>
+double traverse(size_t capacity, size_t& count, Traverse traverse)
+{
+    const size_t n = 1000000;
+    std::mt19937_64 rng(34);
+    Tree tree;
+    for (size_t i = 0; i < n; i++)
+    {
+        tree.insert(long(rng() % (n * 4)));
+    }
+    tree.set_write_buffer(capacity);
+    for (size_t i = 0; i < n / 10; i++)
+    {
+        tree.buffer_insert(long(rng() % (n * 4)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    count += traverse(tree);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    for (size_t read_every : { 0u, 64u, 4u })
+    {
+        size_t found = 0;
+        std::cout << "find every " << read_every << " inserts:";
+        for (size_t capacity : { 0u, 16u, 64u, 256u })
+        {
+            std::cout << " capacity " << capacity << " " << run(capacity, read_every, found) << " ms,";
+        }
+        std::cout << " " << found << " found" << std::endl;
+    }
+
+    for (size_t capacity : { 0u, 64u, 256u })
+    {
+        size_t count = 0;
+        const double merged = traverse(capacity, count, [](const Tree& tree)
+        {
+            size_t keys = 0;
+            for (auto iter = tree.begin(), end = tree.end(); iter != end; ++iter)
+            {
+                keys++;
+            }
+            return keys;
+        });
+        const double flushed = traverse(capacity, count, [](Tree& tree)
+        {
+            size_t keys = 0;
+            for (auto iter = tree.begin(), end = tree.end(); iter != end; ++iter)
+            {
+                keys++;
+            }
+            return keys;
+        });
+        std::cout << "traverse, capacity " << capacity << ": merged " << merged << " ms, flushed by begin() "
+                  << flushed << " ms (" << count << " keys)" << std::endl;
+    }
+    return 0;
+}
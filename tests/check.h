@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+// like assert, but kept in release builds; variadic for the commas of template arguments
+#define CHECK(...) \
+    do \
+    { \
+        if (!(__VA_ARGS__)) \
+        { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #__VA_ARGS__); \
+            std::exit(1); \
+        } \
+    } while (false)
+
+// the keys of a tree in iteration order
+template <typename Tree>
+std::vector<typename Tree::key_type> keys_of(const Tree& tree)
+{
+    std::vector<typename Tree::key_type> keys;
+    for (auto iter = tree.begin(); iter != tree.end(); ++iter)
+    {
+        keys.push_back(*iter);
+    }
+    return keys;
+}
+
+// compare the keys, the size and the bounds of a tree with a reference set over [lo, hi]
+template <typename Tree, typename Key>
+void check_tree(const Tree& tree, const std::set<Key>& reference, Key lo, Key hi)
+{
+    CHECK(tree.size() == reference.size());
+    CHECK(tree.empty() == reference.empty());
+    CHECK(keys_of(tree) == std::vector<Key>(reference.begin(), reference.end()));
+
+    std::vector<Key> reversed;
+    for (auto iter = tree.end(); iter != tree.begin(); )
+    {
+        --iter;
+        reversed.push_back(*iter);
+    }
+    CHECK(reversed == std::vector<Key>(reference.rbegin(), reference.rend()));
+
+    for (Key key = lo; key <= hi; key++)
+    {
+        CHECK(tree.contains(key) == (reference.count(key) == 1));
+        CHECK((tree.find(key) != tree.end()) == (reference.count(key) == 1));
+
+        auto lower = tree.lower_bound(key);
+        auto expected_lower = reference.lower_bound(key);
+        CHECK((lower == tree.end()) == (expected_lower == reference.end()));
+        CHECK(expected_lower == reference.end() || *lower == *expected_lower);
+
+        auto upper = tree.upper_bound(key);
+        auto expected_upper = reference.upper_bound(key);
+        CHECK((upper == tree.end()) == (expected_upper == reference.end()));
+        CHECK(expected_upper == reference.end() || *upper == *expected_upper);
+    }
+}
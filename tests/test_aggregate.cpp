@@ -0,0 +1,92 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// query and aggregate against sums, minima and maxima over a reference set
+
+struct Square
+{
+    long operator()(int key) const { return long(key) * key; }
+};
+
+// a disabled policy adds nothing to the nodes
+static_assert(sizeof(BPlusTree<int, 4>::node_type) < sizeof(BPlusTree<int, 4, std::less<int>, SumAggregate<int>>::node_type),
+              "NoAggregate must not be stored in the nodes");
+
+template <typename Tree, typename Expected>
+void check_queries(const Tree& tree, const std::set<int>& reference, std::mt19937& rng, Expected expected)
+{
+    CHECK(tree.aggregate() == expected(reference.begin(), reference.end()));
+    for (int i = 0; i < 50; i++)
+    {
+        int lo = int(rng() % 600) - 50, hi = int(rng() % 600) - 50;
+        if (hi < lo)
+        {
+            std::swap(lo, hi);
+        }
+        CHECK(tree.query(lo, hi) == expected(reference.lower_bound(lo), reference.upper_bound(hi)));
+    }
+}
+
+template <typename Tree, typename Expected>
+void run(Expected expected)
+{
+    std::mt19937 rng(26);
+    for (int round = 0; round < 20; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        for (int op = 0; op < 1000; op++)
+        {
+            const int key = int(rng() % 500);
+            if (rng() % 3 != 0)
+            {
+                CHECK(tree.insert(key).second == reference.insert(key).second);
+            }
+            else
+            {
+                auto iter = tree.find(key);
+                CHECK((iter != tree.end()) == (reference.erase(key) == 1));
+                if (iter != tree.end())
+                {
+                    tree.erase(iter);
+                }
+            }
+            if (op % 100 == 0)
+            {
+                check_queries(tree, reference, rng, expected);
+            }
+        }
+        check_queries(tree, reference, rng, expected);
+    }
+}
+
+int main()
+{
+    using Iterator = std::set<int>::const_iterator;
+
+    run<BPlusTree<int, 4, std::less<int>, SumAggregate<int, Square>>>([](Iterator first, Iterator last)
+    {
+        long sum = 0;
+        for (; first != last; ++first)
+        {
+            sum += long(*first) * *first;
+        }
+        return sum;
+    });
+    run<BPlusTree<int, 3, std::less<int>, MinAggregate<int>>>([](Iterator first, Iterator last)
+    {
+        return first == last ? MinAggregate<int>::identity() : *first;
+    });
+    run<BPlusTree<int, 7, std::less<int>, MaxAggregate<int>>>([](Iterator first, Iterator last)
+    {
+        return first == last ? MaxAggregate<int>::identity() : *std::prev(last);
+    });
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// find_batch and contains_batch give the same answers as find, in the order of the keys
+
+template <typename Tree>
+void run()
+{
+    std::mt19937 rng(27);
+    for (int n : { 0, 1, 15, 16, 17, 1000, 20000 })
+    {
+        Tree tree;
+        std::set<int> reference;
+        for (int i = 0; i < n; i++)
+        {
+            const int key = int(rng() % (4 * n + 1));
+            tree.insert(key);
+            reference.insert(key);
+        }
+
+        std::vector<int> keys;
+        for (int i = 0; i < 3 * n + 40; i++)
+        {
+            keys.push_back(int(rng() % (4 * n + 10)) - 5);
+        }
+
+        std::vector<typename Tree::iterator> found;
+        tree.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+        std::vector<bool> contained;
+        static_cast<const Tree&>(tree).contains_batch(keys.begin(), keys.end(), std::back_inserter(contained));
+
+        CHECK(found.size() == keys.size());
+        CHECK(contained.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            const bool expected = reference.count(keys[i]) == 1;
+            CHECK(contained[i] == expected);
+            CHECK((found[i] != tree.end()) == expected);
+            CHECK(!expected || (found[i] == tree.find(keys[i]) && *found[i] == keys[i]));
+        }
+    }
+}
+
+int main()
+{
+    run<BPlusTree<int, 3>>();
+    run<BPlusTree<int, 16>>();
+    run<BPlusTree<int, 64, std::less<int>, NoAggregate<int>, 8>>();
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
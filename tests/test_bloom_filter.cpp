@@ -0,0 +1,97 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// the filter never rejects a present key, its false positive rate matches the README, and
+// the lookups only probe it
+
+void check_filter_rates()
+{
+    const size_t n = 100000;
+    for (size_t bits : { 4u, 8u, 12u })
+    {
+        BlockedBloomFilter<long> filter(n, bits);
+        for (long i = 0; i < long(n); i++)
+        {
+            filter.insert(i * 2);
+        }
+        size_t false_positives = 0;
+        for (long i = 0; i < long(n); i++)
+        {
+            CHECK(filter.may_contain(i * 2));
+            false_positives += filter.may_contain(i * 2 + 1);
+        }
+        const double rate = double(false_positives) / double(n);
+        const double bound = bits == 4u ? 0.2 : bits == 8u ? 0.04 : 0.012;
+        std::cout << bits << " bits per key: " << rate * 100 << "% false positives" << std::endl;
+        CHECK(rate < bound);
+    }
+}
+
+int main()
+{
+    check_filter_rates();
+
+    BPlusTree<int, 16> tree;
+    const BPlusTree<int, 16>& const_tree = tree;
+    tree.set_bloom_filter(8);
+    CHECK(tree.bloom_filter() == 8);
+
+    std::set<int> reference;
+    for (int i = 0; i < 20000; i += 2)
+    {
+        tree.insert(i);
+        reference.insert(i);
+    }
+    for (int i = 0; i < 20000; i += 4)
+    {
+        tree.erase(i);
+        reference.erase(i);
+    }
+
+    // erased keys stay in the filter, the tree still answers them
+    const size_t filter_bytes = const_tree.memory_footprint().filter_bytes;
+    CHECK(filter_bytes != 0);
+    check_tree(const_tree, reference, -1, 40000);
+    CHECK(const_tree.memory_footprint().filter_bytes == filter_bytes);
+
+    std::mt19937 rng(37);
+    for (int op = 0; op < 20000; op++)
+    {
+        const int key = int(rng() % 40000);
+        if (rng() % 2 != 0)
+        {
+            CHECK(tree.insert(key).second == reference.insert(key).second);
+        }
+        else
+        {
+            CHECK(tree.erase(key) == reference.erase(key));
+        }
+    }
+    check_tree(tree, reference, -1, 40000);
+
+    erase_if(tree, [](int key) { return key % 3 == 0; });
+    for (auto iter = reference.begin(); iter != reference.end(); )
+    {
+        iter = *iter % 3 == 0 ? reference.erase(iter) : std::next(iter);
+    }
+    check_tree(tree, reference, -1, 40000);
+
+    tree.clear();
+    reference.clear();
+    check_tree(tree, reference, -1, 100);
+    tree.insert(5);
+    reference.insert(5);
+    check_tree(tree, reference, -1, 100);
+
+    tree.set_bloom_filter(0);
+    CHECK(tree.memory_footprint().filter_bytes == 0);
+    check_tree(tree, reference, -1, 100);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// memory_footprint, shrink_to_fit and compact_step keep the keys and the aggregates
+
+using Tree = BPlusTree<int, 4, std::less<int>, SumAggregate<int>>;
+
+void check_sum(const Tree& tree, const std::set<int>& reference)
+{
+    long sum = 0;
+    for (int key : reference)
+    {
+        sum += key;
+    }
+    CHECK(tree.aggregate() == sum);
+}
+
+int main()
+{
+    std::mt19937 rng(30);
+    for (int round = 0; round < 12; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        tree.set_erase_policy(Tree::ErasePolicy(round % 3), 1 + round % 2);
+        for (int i = 0; i < 2000; i++)
+        {
+            tree.insert(i);
+            reference.insert(i);
+        }
+        for (int i = 0; i < 1500; i++)
+        {
+            const int key = int(rng() % 2000);
+            CHECK(tree.erase(key) == reference.erase(key));
+        }
+
+        const auto before = tree.memory_footprint();
+        CHECK(before.leaf_record_count == reference.size());
+        if (round % 2 == 0)
+        {
+            const std::ptrdiff_t freed = tree.shrink_to_fit();
+            CHECK(std::ptrdiff_t(before.total()) - std::ptrdiff_t(tree.memory_footprint().total()) == freed);
+        }
+        else
+        {
+            int steps = 0;
+            while (!tree.compact_step(3))
+            {
+                if (steps++ % 10 == 0)
+                {
+                    check_tree(tree, reference, -1, 2001);
+                }
+            }
+        }
+
+        const auto after = tree.memory_footprint();
+        CHECK(after.leaf_record_count == reference.size());
+        CHECK(after.leaf_count <= before.leaf_count);
+        CHECK(after.leaf_fill() >= before.leaf_fill());
+        CHECK(after.leaf_fill() > 0.5);
+        check_tree(tree, reference, -1, 2001);
+        check_sum(tree, reference);
+
+        for (int i = 0; i < 300; i++)
+        {
+            const int key = int(rng() % 2100);
+            if (rng() % 2 != 0)
+            {
+                CHECK(tree.insert(key).second == reference.insert(key).second);
+            }
+            else
+            {
+                CHECK(tree.erase(key) == reference.erase(key));
+            }
+        }
+        check_tree(tree, reference, -1, 2101);
+        check_sum(tree, reference);
+    }
+
+    // a lower target splits the full leaves, order 8 at 0.75 leaves 6 records in each one
+    BPlusTree<int, 8> packed;
+    std::set<int> reference;
+    for (int i = 0; i < 1000; i++)
+    {
+        packed.insert(i);
+        reference.insert(i);
+    }
+    packed.shrink_to_fit();
+    CHECK(packed.memory_footprint().leaf_count == 125);
+    CHECK(packed.shrink_to_fit(0.75) < 0);
+    const auto footprint = packed.memory_footprint();
+    CHECK(footprint.leaf_count == 167);
+    size_t exact = 0;
+    for (auto iter = packed.begin(); iter != packed.end(); )
+    {
+        // count the leaves of 6 records by walking the keys leaf by leaf
+        auto node = iter.node;
+        size_t records = 0;
+        for (; iter != packed.end() && iter.node == node; ++iter)
+        {
+            records++;
+        }
+        exact += records == 6 ? 1 : 0;
+    }
+    CHECK(exact >= footprint.leaf_count - 2);
+    check_tree(packed, reference, -1, 1001);
+    packed.shrink_to_fit(0.1);
+    CHECK(packed.memory_footprint().leaf_fill() == 0.5);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
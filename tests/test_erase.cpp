@@ -0,0 +1,69 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// erase(key) and erase_if against a reference set, with every erase policy
+
+template <typename Tree>
+void run(std::mt19937& rng)
+{
+    for (int round = 0; round < 15; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        tree.set_erase_policy(typename Tree::ErasePolicy(round % 3), 1 + round % 2);
+        const int range = 50 + round * 40;
+        for (int op = 0; op < 2000; op++)
+        {
+            const int key = int(rng() % range);
+            const int kind = int(rng() % 100);
+            if (kind < 55)
+            {
+                CHECK(tree.insert(key).second == reference.insert(key).second);
+            }
+            else if (kind < 98)
+            {
+                CHECK(tree.erase(key) == reference.erase(key));
+            }
+            else
+            {
+                const int modulus = 2 + int(rng() % 5);
+                auto pred = [modulus](int value) { return value % modulus == 0; };
+                size_t expected = 0;
+                for (auto iter = reference.begin(); iter != reference.end(); )
+                {
+                    if (pred(*iter))
+                    {
+                        iter = reference.erase(iter);
+                        expected++;
+                    }
+                    else
+                    {
+                        ++iter;
+                    }
+                }
+                CHECK(erase_if(tree, pred) == expected);
+                check_tree(tree, reference, -1, range);
+            }
+        }
+        check_tree(tree, reference, -1, range);
+        CHECK(erase_if(tree, [](int) { return true; }) == reference.size());
+        CHECK(tree.empty());
+        check_tree(tree, std::set<int>(), -1, range);
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(28);
+    run<BPlusTree<int, 2>>(rng);
+    run<BPlusTree<int, 3>>(rng);
+    run<BPlusTree<int, 8, std::less<int>, NoAggregate<int>, 8>>(rng);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
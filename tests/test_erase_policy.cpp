@@ -0,0 +1,65 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// the relaxed erase policies keep the keys while leaves go underfull, going back to EAGER
+// repacks the tree
+
+using Tree = BPlusTree<int, 6, std::less<int>, SumAggregate<int>>;
+
+int main()
+{
+    std::mt19937 rng(32);
+    for (int round = 0; round < 30; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        const auto policy = round % 2 == 0 ? Tree::ErasePolicy::MIN_FILL : Tree::ErasePolicy::FREE_AT_EMPTY;
+        tree.set_erase_policy(policy, 1 + round % 3);
+        CHECK(tree.erase_policy() == policy);
+
+        for (int i = 0; i < 1000; i++)
+        {
+            tree.insert(i);
+            reference.insert(i);
+        }
+        for (int op = 0; op < 3000; op++)
+        {
+            const int key = int(rng() % 1000);
+            if (rng() % 4 == 0)
+            {
+                CHECK(tree.insert(key).second == reference.insert(key).second);
+            }
+            else
+            {
+                CHECK(tree.erase(key) == reference.erase(key));
+            }
+            if (op % 500 == 0)
+            {
+                check_tree(tree, reference, -1, 1000);
+            }
+        }
+        check_tree(tree, reference, -1, 1000);
+        CHECK(tree.memory_footprint().leaf_record_count == reference.size());
+
+        tree.set_erase_policy(Tree::ErasePolicy::EAGER);
+        CHECK(tree.erase_policy() == Tree::ErasePolicy::EAGER);
+        check_tree(tree, reference, -1, 1000);
+        const auto footprint = tree.memory_footprint();
+        CHECK(footprint.leaf_count <= 1 || footprint.leaf_fill() >= 0.5);
+
+        long sum = 0;
+        for (int key : reference)
+        {
+            sum += key;
+        }
+        CHECK(tree.aggregate() == sum);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
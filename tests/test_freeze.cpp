@@ -0,0 +1,73 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// freeze() and freeze_packed() keep the keys and answer the lookups of the tree, at every
+// leaf and block boundary
+
+template <typename Frozen>
+void check_frozen(const Frozen& frozen, const std::set<long>& reference, std::mt19937_64& rng, long range)
+{
+    CHECK(frozen.size() == reference.size());
+    CHECK(frozen.empty() == reference.empty());
+    CHECK(std::vector<long>(frozen.begin(), frozen.end()) == std::vector<long>(reference.begin(), reference.end()));
+    for (int i = 0; i < 2000; i++)
+    {
+        const long key = long(rng() % (range + 20)) - 10;
+        CHECK(frozen.contains(key) == (reference.count(key) == 1));
+        CHECK((frozen.find(key) != frozen.end()) == (reference.count(key) == 1));
+
+        auto lower = frozen.lower_bound(key);
+        auto expected_lower = reference.lower_bound(key);
+        CHECK((lower == frozen.end()) == (expected_lower == reference.end()));
+        CHECK(expected_lower == reference.end() || *lower == *expected_lower);
+
+        auto upper = frozen.upper_bound(key);
+        auto expected_upper = reference.upper_bound(key);
+        CHECK((upper == frozen.end()) == (expected_upper == reference.end()));
+        CHECK(expected_upper == reference.end() || *upper == *expected_upper);
+
+        auto range_of_key = frozen.equal_range(key);
+        CHECK(range_of_key.second - range_of_key.first == long(reference.count(key)));
+    }
+}
+
+int main()
+{
+    std::mt19937_64 rng(29);
+    for (size_t n : { 0, 1, 2, 7, 8, 9, 63, 64, 65, 127, 128, 129, 1000, 1024, 5000, 70000 })
+    {
+        for (long range : { long(n) * 2 + 1, long(n) * 1000 + 1, long(1) << 50 })
+        {
+            BPlusTree<long, 16> tree;
+            std::set<long> reference;
+            while (reference.size() < n)
+            {
+                const long key = long(rng() % range) - (range > 1000 ? 5 : 0);
+                reference.insert(key);
+                tree.insert(key);
+            }
+            check_frozen(tree.freeze(), reference, rng, range);
+            check_frozen(tree.freeze_packed(), reference, rng, range);
+        }
+    }
+
+    // dense keys pack into a fraction of the plain layout, sparse ones stay raw
+    BPlusTree<long, 16> dense, sparse;
+    for (long i = 0; i < 10000; i++)
+    {
+        dense.insert(i * 3);
+        sparse.insert(i << 50);
+    }
+    const auto packed = dense.freeze_packed();
+    CHECK(packed.leaves().raw_leaves() == 0);
+    CHECK(packed.memory_footprint() * 3 < dense.freeze().memory_footprint());
+    CHECK(sparse.freeze_packed().leaves().raw_leaves() != 0);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <iostream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#include "BPlusTree.h"
+#include "KeyEncoding.h"
+#include "check.h"
+
+// the encoding round-trips, orders byte-wise like the tuples, and prefix_range finds all
+// keys with the same leading fields
+
+using Fields = std::tuple<std::int32_t, std::string, double, std::uint16_t>;
+
+Fields random_fields(std::mt19937& rng)
+{
+    static const std::string alphabet("ab\0\xff", 4);
+    std::string text;
+    for (size_t i = rng() % 4; i > 0; i--)
+    {
+        text.push_back(alphabet[rng() % alphabet.size()]);
+    }
+    // no -0.0, it equals 0.0 but sorts before it
+    const double reals[] = { -std::numeric_limits<double>::infinity(), -2.5, 0.0, 1e-300, 3.0, 0.5 };
+    return Fields(std::int32_t(rng() % 7) - 3, text, reals[rng() % 6], std::uint16_t(rng() % 3 * 30000));
+}
+
+int main()
+{
+    std::mt19937 rng(40);
+
+    std::vector<Fields> fields;
+    for (int i = 0; i < 2000; i++)
+    {
+        fields.push_back(random_fields(rng));
+        CHECK(KeyEncoding::decode<std::int32_t, std::string, double, std::uint16_t>(KeyEncoding::encode(fields.back())) == fields.back());
+    }
+    for (size_t i = 1; i < fields.size(); i++)
+    {
+        const std::string lhs = KeyEncoding::encode(fields[i - 1]), rhs = KeyEncoding::encode(fields[i]);
+        CHECK((fields[i - 1] < fields[i]) == (lhs < rhs));
+        CHECK((fields[i - 1] == fields[i]) == (lhs == rhs));
+    }
+    CHECK(KeyEncoding::encode(std::int64_t(-1)) < KeyEncoding::encode(std::int64_t(0)));
+    CHECK(KeyEncoding::encode(std::string("a")) < KeyEncoding::encode(std::string("a\0", 2)));
+    CHECK(KeyEncoding::encode(false) < KeyEncoding::encode(true));
+    CHECK(KeyEncoding::encode(-0.0) < KeyEncoding::encode(0.0));
+    CHECK(KeyEncoding::encode(-1.0f) < KeyEncoding::encode(-0.5f));
+
+    bool thrown = false;
+    try
+    {
+        KeyEncoding::decode<std::string>(std::string("a\0", 2));
+    }
+    catch (const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    thrown = false;
+    try
+    {
+        NormalizedKey<4>(std::string("12345"));
+    }
+    catch (const std::length_error&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    // prefix_range over both key types
+    BPlusTree<std::string, 8> strings;
+    BPlusTree<NormalizedKey<48>, 8> normalized;
+    std::set<Fields> reference;
+    for (const auto& field : fields)
+    {
+        const std::string key = KeyEncoding::encode(field);
+        strings.insert(key);
+        normalized.insert(NormalizedKey<48>(key));
+        reference.insert(field);
+    }
+    CHECK(strings.size() == reference.size() && normalized.size() == reference.size());
+
+    for (std::int32_t first = -4; first <= 4; first++)
+    {
+        for (const std::string& text : { std::string(), std::string("a"), std::string("b\0", 2), std::string("\xff") })
+        {
+            size_t expected = 0;
+            for (const auto& field : reference)
+            {
+                expected += std::get<0>(field) == first && std::get<1>(field) == text;
+            }
+
+            auto range = prefix_range(strings, first, text);
+            size_t count = 0;
+            for (auto iter = range.first; iter != range.second; ++iter, count++)
+            {
+                const auto decoded = KeyEncoding::decode<std::int32_t, std::string, double, std::uint16_t>(*iter);
+                CHECK(std::get<0>(decoded) == first && std::get<1>(decoded) == text);
+            }
+            CHECK(count == expected);
+
+            auto normalized_range = prefix_range(normalized, first, text);
+            count = 0;
+            for (auto iter = normalized_range.first; iter != normalized_range.second; ++iter)
+            {
+                count++;
+            }
+            CHECK(count == expected);
+        }
+
+        size_t expected = 0;
+        for (const auto& field : reference)
+        {
+            expected += std::get<0>(field) == first;
+        }
+        auto range = prefix_range(normalized, first);
+        size_t count = 0;
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            count++;
+        }
+        CHECK(count == expected);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
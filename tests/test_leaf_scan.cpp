@@ -0,0 +1,115 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// scan hands out the records of each leaf in [lo, hi], forward and reverse, with relaxed
+// erase policies, pending messages and a learned index
+
+template <typename Tree>
+void check_scans(Tree& tree, const std::set<int>& reference, std::mt19937& rng)
+{
+    using Range = std::vector<int>;
+    for (int query = 0; query < 30; query++)
+    {
+        const int lo = int(rng() % 220) - 10, hi = int(rng() % 220) - 10;
+        const Range expected(reference.lower_bound(lo), lo <= hi ? reference.upper_bound(hi) : reference.lower_bound(lo));
+
+        Range forward, reverse;
+        tree.scan(lo, hi, [&](typename Tree::leaf_record_iterator first, typename Tree::leaf_record_iterator last)
+        {
+            CHECK(first != last);
+            for (; first != last; ++first)
+            {
+                forward.push_back(first->first);
+            }
+        });
+        tree.scan(lo, hi, [&](typename Tree::leaf_record_iterator first, typename Tree::leaf_record_iterator last)
+        {
+            // the leaves come from the last one, each range ascending
+            CHECK(first != last);
+            CHECK(reverse.empty() || std::prev(last)->first < reverse.back());
+            Range leaf;
+            for (; first != last; ++first)
+            {
+                leaf.push_back(first->first);
+            }
+            reverse.insert(reverse.end(), leaf.rbegin(), leaf.rend());
+        }, true);
+        CHECK(forward == expected);
+        CHECK(reverse == Range(expected.rbegin(), expected.rend()));
+    }
+
+    Range all, all_reversed;
+    tree.scan([&](typename Tree::leaf_record_iterator first, typename Tree::leaf_record_iterator last)
+    {
+        for (; first != last; ++first)
+        {
+            all.push_back(first->first);
+        }
+    });
+    tree.scan([&](typename Tree::leaf_record_iterator first, typename Tree::leaf_record_iterator last)
+    {
+        while (first != last)
+        {
+            all_reversed.push_back((--last)->first);
+        }
+    }, true);
+    CHECK(all == Range(reference.begin(), reference.end()));
+    CHECK(all_reversed == Range(reference.rbegin(), reference.rend()));
+}
+
+template <typename Tree>
+void run(std::mt19937& rng)
+{
+    for (int round = 0; round < 120; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        tree.set_erase_policy(typename Tree::ErasePolicy(round % 3));
+        if (round % 4 == 1)
+        {
+            tree.set_write_buffer(3);
+        }
+
+        for (int op = 0; op < 300; op++)
+        {
+            const int key = int(rng() % (round % 10 * 20 + 5));
+            if (rng() % 3 != 0)
+            {
+                tree.buffer_insert(key);
+                reference.insert(key);
+            }
+            else
+            {
+                tree.buffer_erase(key);
+                reference.erase(key);
+            }
+            if (op % 30 == 0)
+            {
+                if (round % 4 == 3)
+                {
+                    tree.set_learned_index(4);
+                }
+                check_scans(tree, reference, rng);
+                CHECK(tree.pending() == 0);
+            }
+        }
+        check_tree(tree, reference, -1, 200);
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(45);
+    run<BPlusTree<int, 3>>(rng);
+    run<BPlusTree<int, 4>>(rng);
+    run<BPlusTree<int, 16>>(rng);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// the learned index answers like the inner nodes; it survives inserts, is invalidated by
+// freed leaves, and only the non-const lookups refit it
+
+using Tree = BPlusTree<long, 16>;
+
+void check_lookups(Tree& tree, const std::set<long>& reference, long step)
+{
+    const Tree& const_tree = tree;
+    for (long key = -3; key < 1000010; key += step)
+    {
+        CHECK((const_tree.find(key) != const_tree.end()) == (reference.count(key) == 1));
+        CHECK((tree.find(key) != tree.end()) == (reference.count(key) == 1));
+
+        auto lower = tree.lower_bound(key);
+        auto expected_lower = reference.lower_bound(key);
+        CHECK((lower == tree.end()) == (expected_lower == reference.end()));
+        CHECK(expected_lower == reference.end() || *lower == *expected_lower);
+
+        auto upper = const_tree.upper_bound(key);
+        auto expected_upper = reference.upper_bound(key);
+        CHECK((upper == const_tree.end()) == (expected_upper == reference.end()));
+        CHECK(expected_upper == reference.end() || *upper == *expected_upper);
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(36);
+    for (size_t epsilon : { 1u, 4u, 32u })
+    {
+        Tree tree;
+        std::set<long> reference;
+        for (int i = 0; i < 20000; i++)
+        {
+            const long key = long(rng() % 1000000);
+            tree.insert(key);
+            reference.insert(key);
+        }
+        tree.set_learned_index(epsilon);
+        CHECK(tree.learned_index() == epsilon);
+        const Tree& const_tree = tree;
+        CHECK(const_tree.learned_segments() != 0);
+        check_lookups(tree, reference, 37);
+
+        // splits keep the snapshot usable until too many leaves are missing from it
+        for (int i = 0; i < 1000; i++)
+        {
+            const long key = long(rng() % 1000000);
+            tree.insert(key);
+            reference.insert(key);
+        }
+        check_lookups(tree, reference, 37);
+
+        // freeing leaves invalidates the model, the const lookups leave it invalid
+        auto pred = [](long key) { return key % 4 != 0; };
+        erase_if(tree, pred);
+        for (auto iter = reference.begin(); iter != reference.end(); )
+        {
+            iter = pred(*iter) ? reference.erase(iter) : std::next(iter);
+        }
+        CHECK(const_tree.learned_segments() == 0);
+        for (long key = 0; key < 1000000; key += 17)
+        {
+            CHECK((const_tree.find(key) != const_tree.end()) == (reference.count(key) == 1));
+        }
+        CHECK(const_tree.learned_segments() == 0);
+
+        // the non-const lookups refit it
+        check_lookups(tree, reference, 17);
+        CHECK(const_tree.learned_segments() != 0);
+
+        tree.set_learned_index(0);
+        CHECK(const_tree.learned_segments() == 0);
+        check_lookups(tree, reference, 37);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// cached positions stay correct through splits, erases, borrows and repacks; the const
+// lookups skip the cache and its stats; merges in other leaves keep the hot entries
+
+template <typename Tree>
+void run(std::mt19937& rng)
+{
+    for (int round = 0; round < 20; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        tree.set_lookup_cache(8 + round * 4);
+        CHECK(tree.lookup_cache() >= size_t(8 + round * 4));
+        tree.set_erase_policy(typename Tree::ErasePolicy(round % 3));
+
+        for (int op = 0; op < 4000; op++)
+        {
+            // a few hot keys among the lookups
+            const int key = rng() % 2 == 0 ? int(rng() % 8) : int(rng() % 500);
+            const int kind = int(rng() % 10);
+            if (kind < 3)
+            {
+                CHECK(tree.insert(key).second == reference.insert(key).second);
+            }
+            else if (kind < 5)
+            {
+                CHECK(tree.erase(key) == reference.erase(key));
+            }
+            else if (kind < 9)
+            {
+                auto iter = tree.find(key);
+                CHECK((iter != tree.end()) == (reference.count(key) == 1));
+                CHECK(iter == tree.end() || *iter == key);
+            }
+            else if (rng() % 50 == 0)
+            {
+                tree.shrink_to_fit();
+            }
+        }
+        check_tree(tree, reference, -1, 501);
+
+        const auto stats = tree.cache_stats();
+        CHECK(stats.hits != 0);
+        CHECK(stats.hit_rate() > 0.0 && stats.hit_rate() < 1.0);
+
+        // check_tree only used the const lookups
+        const Tree& const_tree = tree;
+        for (int key = 0; key < 8; key++)
+        {
+            const_tree.find(key);
+        }
+        CHECK(tree.cache_stats().hits == stats.hits && tree.cache_stats().misses == stats.misses);
+
+        tree.reset_cache_stats();
+        CHECK(tree.cache_stats().hits == 0 && tree.cache_stats().misses == 0);
+        tree.set_lookup_cache(0);
+        CHECK(tree.lookup_cache() == 0);
+        check_tree(tree, reference, -1, 501);
+    }
+}
+
+template <typename Tree>
+void run_far_merges()
+{
+    Tree tree;
+    for (int key = 0; key < 4000; key++)
+    {
+        tree.insert(key);
+    }
+    tree.set_lookup_cache(64);
+    for (int key = 0; key < 4; key++)
+    {
+        CHECK(tree.find(key) != tree.end());
+    }
+    const auto warm = tree.cache_stats();
+
+    // frees leaves far from the hot ones, their entries stay valid
+    for (int key = 2000; key < 3000; key++)
+    {
+        CHECK(tree.erase(key) == 1u);
+    }
+    for (int key = 0; key < 4; key++)
+    {
+        CHECK(tree.find(key) != tree.end() && *tree.find(key) == key);
+    }
+    CHECK(tree.cache_stats().misses == warm.misses);
+    CHECK(tree.cache_stats().hits == warm.hits + 8u);
+
+    // erasing in the hot leaf renews its version
+    CHECK(tree.erase(3) == 1u);
+    CHECK(tree.find(0) != tree.end());
+    CHECK(tree.cache_stats().misses == warm.misses + 1u);
+
+    tree.clear();
+    CHECK(tree.find(1) == tree.end());
+}
+
+int main()
+{
+    std::mt19937 rng(38);
+    run<BPlusTree<int, 3>>(rng);
+    run<BPlusTree<int, 8>>(rng);
+    run<BPlusTree<int, 16, std::less<int>, NoAggregate<int>, 8>>(rng);
+    run_far_merges<BPlusTree<int, 8>>();
+    run_far_merges<BPlusTree<int, 16, std::less<int>, NoAggregate<int>, 8>>();
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
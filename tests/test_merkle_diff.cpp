@@ -0,0 +1,115 @@
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// equal key sets hash equal whatever the shapes of their trees, diff writes the symmetric
+// difference in key order
+
+std::vector<std::pair<int, bool>> expected_diff(const std::set<int>& lhs, const std::set<int>& rhs)
+{
+    std::vector<std::pair<int, bool>> result;
+    for (int key : lhs)
+    {
+        if (rhs.count(key) == 0)
+        {
+            result.emplace_back(key, true);
+        }
+    }
+    for (int key : rhs)
+    {
+        if (lhs.count(key) == 0)
+        {
+            result.emplace_back(key, false);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+int main()
+{
+    using Tree = BPlusTree<int, 5, std::less<int>, MerkleAggregate<int>>;
+    std::mt19937 rng(39);
+    for (int round = 0; round < 30; round++)
+    {
+        const int n = 10 + round * 100;
+        std::vector<int> keys;
+        for (int i = 0; i < n; i++)
+        {
+            keys.push_back(int(rng() % (4 * n)));
+        }
+
+        // the same keys in another order, and shrunk: a different shape
+        Tree lhs, rhs;
+        std::set<int> lhs_reference, rhs_reference;
+        for (int key : keys)
+        {
+            lhs.insert(key);
+            lhs_reference.insert(key);
+        }
+        std::shuffle(keys.begin(), keys.end(), rng);
+        for (int key : keys)
+        {
+            rhs.insert(key);
+            rhs_reference.insert(key);
+        }
+        if (round % 2 == 0)
+        {
+            rhs.shrink_to_fit();
+        }
+        CHECK(lhs.aggregate() == rhs.aggregate());
+
+        std::vector<std::pair<int, bool>> differences;
+        lhs.diff(rhs, std::back_inserter(differences));
+        CHECK(differences.empty());
+
+        // a few edits on both sides
+        for (int i = 0; i < 1 + round % 7; i++)
+        {
+            const int key = int(rng() % (4 * n));
+            if (rng() % 2 != 0)
+            {
+                lhs.insert(key);
+                lhs_reference.insert(key);
+            }
+            else
+            {
+                rhs.erase(key);
+                rhs_reference.erase(key);
+            }
+        }
+        CHECK((lhs.aggregate() == rhs.aggregate()) == (lhs_reference == rhs_reference));
+
+        differences.clear();
+        lhs.diff(rhs, std::back_inserter(differences));
+        CHECK(differences == expected_diff(lhs_reference, rhs_reference));
+
+        differences.clear();
+        rhs.diff(lhs, std::back_inserter(differences));
+        CHECK(differences == expected_diff(rhs_reference, lhs_reference));
+
+        for (int lo = -1; lo < 4 * n; lo += n / 3 + 1)
+        {
+            const int hi = lo + n;
+            Tree lhs_range, rhs_range;
+            for (auto iter = lhs_reference.lower_bound(lo); iter != lhs_reference.upper_bound(hi); ++iter)
+            {
+                lhs_range.insert(*iter);
+            }
+            for (auto iter = rhs_reference.lower_bound(lo); iter != rhs_reference.upper_bound(hi); ++iter)
+            {
+                rhs_range.insert(*iter);
+            }
+            CHECK(lhs.query(lo, hi) == lhs_range.aggregate());
+            CHECK(rhs.query(lo, hi) == rhs_range.aggregate());
+        }
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// build_parallel sorts, drops duplicates keeping the first one, and yields a tree that
+// answers and changes like one built by inserts, for any number of workers
+
+struct Modulo
+{
+    long operator()(int key) const { return key % 1000; }
+};
+
+struct Tagged
+{
+    int key;
+    int tag;
+};
+
+struct TaggedLess
+{
+    bool operator()(const Tagged& lhs, const Tagged& rhs) const { return lhs.key < rhs.key; }
+};
+
+template <typename Tree>
+void check_built(Tree& tree, const std::vector<int>& input)
+{
+    std::set<int> reference(input.begin(), input.end());
+    CHECK(keys_of(tree) == std::vector<int>(reference.begin(), reference.end()));
+    long sum = 0;
+    for (int key : reference)
+    {
+        sum += key % 1000;
+    }
+    CHECK(tree.aggregate() == sum);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        const int key = i * 37 % 5000;
+        tree.insert(key);
+        tree.erase(key + 1);
+        reference.insert(key);
+        reference.erase(key + 1);
+    }
+    check_tree(tree, reference, -1, 5001);
+}
+
+int main()
+{
+    std::mt19937 rng(43);
+    for (size_t n : { 0, 1, 5, 100, 20000, 40000 })
+    {
+        for (size_t threads : { 1, 2, 3, 8, 0 })
+        {
+            for (int modulus : { 3, 1000, 1 << 30 })
+            {
+                std::vector<int> input(n);
+                for (auto& key : input)
+                {
+                    key = int(rng() % modulus);
+                }
+                auto tree = BPlusTree<int, 7, std::less<int>, SumAggregate<int, Modulo>>::build_parallel(input.begin(), input.end(), threads);
+                check_built(tree, input);
+                auto small = BPlusTree<int, 7, std::less<int>, SumAggregate<int, Modulo>, 8>::build_parallel(input.begin(), input.end(), threads);
+                check_built(small, input);
+            }
+        }
+    }
+
+    // equal keys keep the first one of the input
+    std::vector<Tagged> tagged;
+    for (int i = 0; i < 100000; i++)
+    {
+        tagged.push_back(Tagged{ int(rng() % 5000), i });
+    }
+    auto tree = BPlusTree<Tagged, 16, TaggedLess>::build_parallel(tagged.begin(), tagged.end(), 4);
+    std::vector<int> first_tag(5000, -1);
+    for (const auto& value : tagged)
+    {
+        if (first_tag[value.key] < 0)
+        {
+            first_tag[value.key] = value.tag;
+        }
+    }
+    for (const auto& value : tree)
+    {
+        CHECK(first_tag[value.key] == value.tag);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
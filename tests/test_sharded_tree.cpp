@@ -0,0 +1,139 @@
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <thread>
+
+#include "ShardedBPlusTree.h"
+#include "check.h"
+
+// the shards split and merge under skewed inserts without losing keys, and many writers
+// with concurrent scans leave every key they inserted
+
+template <typename Tree>
+void check_sharded(const Tree& tree, const std::set<int>& reference, std::mt19937& rng)
+{
+    CHECK(tree.size() == reference.size());
+    std::vector<int> keys;
+    tree.copy_all(std::back_inserter(keys));
+    CHECK(keys == std::vector<int>(reference.begin(), reference.end()));
+
+    std::vector<int> range;
+    tree.copy_range(30000, 60000, std::back_inserter(range));
+    CHECK(range == std::vector<int>(reference.lower_bound(30000), reference.upper_bound(60000)));
+
+    for (int i = 0; i < 100; i++)
+    {
+        const int key = int(rng() % 100000);
+        CHECK(tree.contains(key) == (reference.count(key) == 1));
+    }
+
+    size_t total = 0;
+    for (size_t size : tree.shard_sizes())
+    {
+        total += size;
+    }
+    CHECK(total == reference.size());
+    const auto bounds = tree.bounds();
+    CHECK(bounds.size() + 1 == tree.shard_count());
+    CHECK(std::is_sorted(bounds.begin(), bounds.end()));
+}
+
+int main()
+{
+    std::mt19937 rng(44);
+    {
+        ShardedBPlusTree<int, 8> tree(4, 16);
+        std::set<int> reference;
+        for (int op = 0; op < 100000; op++)
+        {
+            // uniform, then a hot range to split, then erases to merge
+            const int phase = op / 25000;
+            const int key = phase % 2 == 0 ? int(rng() % 100000) : 50000 + int(rng() % 2000);
+            if (rng() % 3 == 0 || phase == 3)
+            {
+                CHECK(tree.erase(key) == reference.erase(key));
+            }
+            else
+            {
+                CHECK(tree.insert(key) == reference.insert(key).second);
+            }
+            if (op % 5000 == 0)
+            {
+                check_sharded(tree, reference, rng);
+            }
+        }
+        check_sharded(tree, reference, rng);
+    }
+
+    for (size_t writers : { 1, 4, 16, 64 })
+    {
+        ShardedBPlusTree<long, 16> tree(8, 64);
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < writers; w++)
+        {
+            threads.emplace_back([&tree, w, writers]()
+            {
+                std::mt19937 local(static_cast<unsigned>(w));
+                for (int i = 0; i < 40000 / int(writers); i++)
+                {
+                    // every writer owns the keys equal to w modulo writers
+                    const long key = long(local() % 1000000) * long(writers) + long(w);
+                    tree.insert(key);
+                    if (i % 4 == 0)
+                    {
+                        tree.erase(key);
+                    }
+                    if (i % 1000 == 0)
+                    {
+                        long previous = -1;
+                        tree.for_each(0, 1L << 40, [&](long value)
+                        {
+                            CHECK(value > previous);
+                            previous = value;
+                        });
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        // replay each writer alone
+        std::set<long> reference;
+        for (size_t w = 0; w < writers; w++)
+        {
+            std::mt19937 local(static_cast<unsigned>(w));
+            for (int i = 0; i < 40000 / int(writers); i++)
+            {
+                const long key = long(local() % 1000000) * long(writers) + long(w);
+                reference.insert(key);
+                if (i % 4 == 0)
+                {
+                    reference.erase(key);
+                }
+            }
+        }
+        std::vector<long> keys;
+        tree.copy_all(std::back_inserter(keys));
+        CHECK(keys == std::vector<long>(reference.begin(), reference.end()));
+        CHECK(tree.size() == reference.size());
+    }
+
+    ShardedBPlusTree<int> bounded(std::vector<int>{ 10, 20, 30 }, 4);
+    CHECK(bounded.shard_count() == 4);
+    for (int key = 0; key < 40; key++)
+    {
+        bounded.insert(key);
+    }
+    CHECK(bounded.size() == 40);
+    bounded.clear();
+    CHECK(bounded.empty());
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
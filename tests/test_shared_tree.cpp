@@ -0,0 +1,163 @@
+#include <iostream>
+#include <functional>
+#include <atomic>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "SharedBPlusTree.h"
+#include "check.h"
+
+// forked readers see whole versions while the writer changes the tree, a second writer is
+// refused, and a writer dying mid-update is reported instead of blocking the readers
+
+using Tree = SharedBPlusTree<long, 8>;
+
+const long key_count = 20000;
+
+std::string segment_path()
+{
+    const char* directory = ::access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+    return std::string(directory) + "/bplustree_test_" + std::to_string(::getpid());
+}
+
+// every version holds the keys [first, last) and nothing else, until -1 marks the end;
+// a byte to ready tells the writer that the reader is running
+int run_reader(const std::string& path, int ready)
+{
+    Tree tree = Tree::open(path);
+    for (size_t reads = 0; ; reads++)
+    {
+        if (reads == 1 && ::write(ready, "r", 1) != 1)
+        {
+            return 1;
+        }
+        std::vector<long> keys;
+        tree.copy_all(std::back_inserter(keys));
+        if (keys == std::vector<long>{ -1 })
+        {
+            return 0;
+        }
+        for (size_t i = 1; i < keys.size(); i++)
+        {
+            if (keys[i] != keys[i - 1] + 1)
+            {
+                return 1;
+            }
+        }
+        if (!keys.empty() && (keys.front() < 0 || keys.back() >= key_count))
+        {
+            return 1;
+        }
+        std::vector<long> range;
+        tree.copy_range(100, 199, std::back_inserter(range));
+        if (range.size() > 100 || (!range.empty() && range.back() - range.front() + 1 != long(range.size())))
+        {
+            return 1;
+        }
+    }
+}
+
+int main()
+{
+    const std::string path = segment_path();
+    {
+        Tree writer = Tree::create(path, 16u << 20);
+        CHECK(writer.writable());
+
+        bool refused = false;
+        try
+        {
+            Tree::open(path, true);
+        }
+        catch (const std::runtime_error&)
+        {
+            refused = true;
+        }
+        CHECK(refused);
+
+        int ready[2];
+        CHECK(::pipe(ready) == 0);
+        std::vector<pid_t> readers;
+        for (int i = 0; i < 4; i++)
+        {
+            const pid_t pid = ::fork();
+            CHECK(pid >= 0);
+            if (pid == 0)
+            {
+                ::_exit(run_reader(path, ready[1]));
+            }
+            readers.push_back(pid);
+        }
+        for (size_t i = 0; i < readers.size(); i++)
+        {
+            char byte;
+            CHECK(::read(ready[0], &byte, 1) == 1);
+        }
+        ::close(ready[0]);
+        ::close(ready[1]);
+
+        for (long key = 0; key < key_count; key++)
+        {
+            CHECK(writer.insert(key));
+        }
+        CHECK(writer.size() == size_t(key_count));
+        for (long key = 0; key < key_count; key++)
+        {
+            CHECK(writer.erase(key) == 1);
+        }
+        CHECK(writer.empty());
+        writer.insert(-1);
+
+        for (pid_t pid : readers)
+        {
+            int status = 0;
+            CHECK(::waitpid(pid, &status, 0) == pid);
+            CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+    }
+
+    // a writer that dies between making the sequence number odd and even again; the
+    // sequence number follows five 8-byte fields at the start of the segment
+    Tree reader = Tree::open(path);
+    CHECK(reader.size() == 1);
+    const pid_t pid = ::fork();
+    CHECK(pid >= 0);
+    if (pid == 0)
+    {
+        Tree writer = Tree::open(path, true);
+        const int fd = ::open(path.c_str(), O_RDWR);
+        void* base = ::mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        reinterpret_cast<std::atomic<std::uint64_t>*>(static_cast<char*>(base) + 40)->fetch_add(1);
+        ::_exit(0);
+    }
+    int status = 0;
+    CHECK(::waitpid(pid, &status, 0) == pid);
+
+    bool reported = false;
+    try
+    {
+        reader.contains(1);
+    }
+    catch (const std::runtime_error&)
+    {
+        reported = true;
+    }
+    CHECK(reported);
+
+    // a new segment replaces it
+    Tree fresh = Tree::create(path, 1u << 20);
+    fresh.insert(1);
+    CHECK(fresh.size() == 1 && fresh.contains(1));
+    ::unlink(path.c_str());
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+#include <string>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// trees of a few keys keep them inline without nodes, promote them into a leaf beyond
+// small_size and demote them again at small_size / 2; a plain tree allocates no feature state
+
+using Tree = BPlusTree<int, 4, std::less<int>, SumAggregate<int>, 8>;
+
+int main()
+{
+    // the inline keys share the storage of the header
+    using Plain = BPlusTree<int, 4, std::less<int>, SumAggregate<int>>;
+    static_assert(sizeof(Tree) == sizeof(Plain), "the inline keys fit in the header");
+    static_assert(sizeof(BPlusTree<int, 4, std::less<int>, SumAggregate<int>, 64>) < sizeof(Plain) + sizeof(std::array<int, 64>),
+                  "a larger array takes only what it exceeds the header by");
+
+    Tree tree;
+    CHECK(tree.is_small());
+    CHECK(tree.memory_footprint().leaf_count == 0);
+    std::set<int> reference;
+
+    for (int key = 0; key < 8; key++)
+    {
+        tree.insert(key * 2);
+        reference.insert(key * 2);
+        CHECK(tree.is_small());
+        check_tree(tree, reference, -1, 20);
+    }
+    CHECK(tree.memory_footprint().leaf_count == 0);
+    CHECK(tree.aggregate() == 56);
+    CHECK(tree.query(3, 9) == 4 + 6 + 8);
+
+    tree.insert(1);
+    reference.insert(1);
+    CHECK(!tree.is_small());
+    check_tree(tree, reference, -1, 20);
+
+    for (int key : { 0, 2, 4, 6, 8 })
+    {
+        tree.erase(key);
+        reference.erase(key);
+    }
+    CHECK(tree.is_small());
+    check_tree(tree, reference, -1, 20);
+
+    // moves carry the inline keys
+    Tree moved(std::move(tree));
+    CHECK(tree.empty() && moved.is_small());
+    check_tree(moved, reference, -1, 20);
+    tree = std::move(moved);
+    check_tree(tree, reference, -1, 20);
+
+    // erasing through an iterator returns the next key
+    auto next = tree.erase(tree.find(10));
+    CHECK(next != tree.end() && *next == 12);
+    reference.erase(10);
+    check_tree(tree, reference, -1, 20);
+
+    std::mt19937 rng(42);
+    for (int op = 0; op < 20000; op++)
+    {
+        const int key = int(rng() % 24);
+        if (rng() % 2 != 0)
+        {
+            CHECK(tree.insert(key).second == reference.insert(key).second);
+        }
+        else
+        {
+            CHECK(tree.erase(key) == reference.erase(key));
+        }
+        CHECK(!tree.is_small() || tree.size() <= 8);
+        CHECK(tree.is_small() || tree.size() > 4);
+        if (op % 100 == 0)
+        {
+            check_tree(tree, reference, -1, 25);
+            long sum = 0;
+            for (int value : reference)
+            {
+                sum += value;
+            }
+            CHECK(tree.aggregate() == sum);
+        }
+    }
+
+    // keys with a destructor through every switch between the inline keys and the header
+    using StringTree = BPlusTree<std::string, 4, std::less<std::string>, NoAggregate<std::string>, 8>;
+    StringTree strings;
+    std::set<std::string> string_reference;
+    for (int op = 0; op < 4000; op++)
+    {
+        const std::string key = "key " + std::to_string(rng() % 24) + std::string(24, 'x');
+        if (rng() % 2 != 0)
+        {
+            CHECK(strings.insert(key).second == string_reference.insert(key).second);
+        }
+        else
+        {
+            CHECK(strings.erase(key) == string_reference.erase(key));
+        }
+        if (op % 500 == 0)
+        {
+            StringTree upper = strings.split_off("key 2");
+            strings.join(std::move(upper));
+            StringTree moved(std::move(strings));
+            strings = std::move(moved);
+        }
+        CHECK(strings.size() == string_reference.size());
+    }
+    auto expected = string_reference.begin();
+    for (const std::string& key : strings)
+    {
+        CHECK(expected != string_reference.end() && key == *expected++);
+    }
+    CHECK(expected == string_reference.end());
+    strings.clear();
+    CHECK(strings.is_small() && strings.empty());
+
+    // the feature state is allocated by the first setter only
+    const size_t plain_bytes = Tree().memory_footprint().total();
+    Tree with_cache;
+    with_cache.set_lookup_cache(16);
+    CHECK(with_cache.memory_footprint().total() > plain_bytes);
+    with_cache.insert(1);
+    CHECK(with_cache.find(1) != with_cache.end());
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
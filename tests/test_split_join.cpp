@@ -0,0 +1,90 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// split_off and join keep the keys, the aggregates and the features of both sides
+
+template <typename Tree>
+void check_sum(const Tree& tree, const std::set<int>& reference)
+{
+    long sum = 0;
+    for (int key : reference)
+    {
+        sum += key;
+    }
+    CHECK(tree.aggregate() == sum);
+}
+
+template <typename Tree>
+void run(std::mt19937& rng)
+{
+    for (int round = 0; round < 20; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        if (round % 4 == 1)
+        {
+            tree.set_erase_policy(Tree::ErasePolicy::FREE_AT_EMPTY);
+        }
+        if (round % 4 == 2)
+        {
+            tree.set_write_buffer(4);
+        }
+        const int range = 10 + round * 40;
+        for (int i = 0; i < range / 2; i++)
+        {
+            const int key = int(rng() % range);
+            tree.buffer_insert(key);
+            reference.insert(key);
+        }
+
+        for (int op = 0; op < 10; op++)
+        {
+            const int key = int(rng() % (range + 2)) - 1;
+            Tree right = tree.split_off(key);
+            std::set<int> right_reference(reference.lower_bound(key), reference.end());
+            reference.erase(reference.lower_bound(key), reference.end());
+
+            CHECK(right.erase_policy() == tree.erase_policy());
+            CHECK(right.write_buffer() == tree.write_buffer());
+            check_tree(tree, reference, -1, range);
+            check_tree(right, right_reference, -1, range);
+            check_sum(tree, reference);
+            check_sum(right, right_reference);
+
+            // both sides stay usable before they are joined back
+            const int inserted = int(rng() % range);
+            if (inserted < key)
+            {
+                tree.insert(inserted);
+                reference.insert(inserted);
+            }
+            else
+            {
+                right.insert(inserted);
+                right_reference.insert(inserted);
+            }
+
+            tree.join(std::move(right));
+            CHECK(right.empty());
+            reference.insert(right_reference.begin(), right_reference.end());
+            check_tree(tree, reference, -1, range);
+            check_sum(tree, reference);
+        }
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(31);
+    run<BPlusTree<int, 3, std::less<int>, SumAggregate<int>>>(rng);
+    run<BPlusTree<int, 8, std::less<int>, SumAggregate<int>>>(rng);
+    run<BPlusTree<int, 5, std::less<int>, SumAggregate<int>, 8>>(rng);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
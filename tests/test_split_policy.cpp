@@ -0,0 +1,60 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// SKEWED leaves full leaves behind ascending and descending inserts, and keeps the keys
+// under random ones
+
+using Tree = BPlusTree<int, 16>;
+
+double fill_after(Tree::SplitPolicy policy, bool ascending)
+{
+    Tree tree;
+    std::set<int> reference;
+    tree.set_split_policy(policy);
+    for (int i = 0; i < 5000; i++)
+    {
+        const int key = ascending ? i : 5000 - i;
+        tree.insert(key);
+        reference.insert(key);
+    }
+    check_tree(tree, reference, -1, 5001);
+    return tree.memory_footprint().leaf_fill();
+}
+
+int main()
+{
+    CHECK(fill_after(Tree::SplitPolicy::EVEN, true) < 0.6);
+    CHECK(fill_after(Tree::SplitPolicy::EVEN, false) < 0.6);
+    CHECK(fill_after(Tree::SplitPolicy::SKEWED, true) > 0.85);
+    CHECK(fill_after(Tree::SplitPolicy::SKEWED, false) > 0.85);
+
+    std::mt19937 rng(33);
+    for (int round = 0; round < 20; round++)
+    {
+        BPlusTree<int, 4> tree;
+        std::set<int> reference;
+        tree.set_split_policy(decltype(tree)::SplitPolicy::SKEWED, 0.5 + round * 0.025);
+        for (int op = 0; op < 2000; op++)
+        {
+            // runs of ascending keys between random ones
+            const int key = op % 50 < 30 ? op * 3 : int(rng() % 6000);
+            if (rng() % 5 != 0)
+            {
+                CHECK(tree.insert(key).second == reference.insert(key).second);
+            }
+            else
+            {
+                CHECK(tree.erase(key) == reference.erase(key));
+            }
+        }
+        check_tree(tree, reference, -1, 6001);
+    }
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <set>
+
+#include "BPlusTree.h"
+#include "check.h"
+
+// buffered inserts and erases against a reference set; the reads merge the pending messages
+// without applying them, but the non-const begin() flushes
+
+template <typename Tree>
+void check_buffered(const Tree& tree, const std::set<int>& reference, int range)
+{
+    const size_t pending = tree.pending();
+    check_tree(tree, reference, -1, range);
+    for (int key = -1; key <= range; key++)
+    {
+        auto equal = tree.equal_range(key);
+        size_t count = 0;
+        for (auto iter = equal.first; iter != equal.second; ++iter)
+        {
+            count++;
+        }
+        CHECK(count == reference.count(key));
+    }
+
+    long sum = 0;
+    for (int key : reference)
+    {
+        sum += key;
+    }
+    CHECK(tree.aggregate() == sum);
+    CHECK(tree.pending() == pending);
+}
+
+template <size_t order>
+void run(std::mt19937& rng)
+{
+    using Tree = BPlusTree<int, order, std::less<int>, SumAggregate<int>>;
+    for (int round = 0; round < 12; round++)
+    {
+        Tree tree;
+        std::set<int> reference;
+        const int range = 50 + round * 40;
+        tree.set_erase_policy(typename Tree::ErasePolicy(round % 3), 1 + round % 2);
+        tree.set_write_buffer(1 + round % 7);
+        if (round % 4 == 1)
+        {
+            tree.set_lookup_cache(16);
+        }
+        if (round % 4 == 2)
+        {
+            tree.set_bloom_filter(8);
+        }
+
+        for (int op = 0; op < 2000; op++)
+        {
+            const int key = int(rng() % range);
+            const int kind = int(rng() % 20);
+            if (kind < 8)
+            {
+                tree.buffer_insert(key);
+                reference.insert(key);
+            }
+            else if (kind < 14)
+            {
+                tree.buffer_erase(key);
+                reference.erase(key);
+            }
+            else if (kind < 16)
+            {
+                CHECK(tree.insert(key).second == reference.insert(key).second);
+            }
+            else if (kind < 18)
+            {
+                CHECK(tree.erase(key) == reference.erase(key));
+            }
+            else if (kind == 18)
+            {
+                // erase through an iterator found by the merged read
+                auto iter = tree.lower_bound(key);
+                auto expected = reference.lower_bound(key);
+                if (expected != reference.end())
+                {
+                    CHECK(*iter == *expected);
+                    iter = tree.erase(iter);
+                    expected = reference.erase(expected);
+                    CHECK((iter == tree.end()) == (expected == reference.end()));
+                    CHECK(expected == reference.end() || *iter == *expected);
+                }
+            }
+            else if (rng() % 40 == 0)
+            {
+                check_buffered(tree, reference, range);
+            }
+            else if (rng() % 100 == 0)
+            {
+                tree.flush();
+            }
+        }
+
+        check_buffered(tree, reference, range);
+        if (round % 2 == 0)
+        {
+            tree.flush();
+        }
+        else
+        {
+            // a traversal of the non-const tree applies the messages first
+            std::vector<int> keys;
+            for (auto iter = tree.begin(); iter != tree.end(); ++iter)
+            {
+                keys.push_back(*iter);
+            }
+            CHECK(keys == std::vector<int>(reference.begin(), reference.end()));
+        }
+        CHECK(tree.pending() == 0);
+        check_buffered(tree, reference, range);
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(34);
+    run<2>(rng);
+    run<3>(rng);
+    run<4>(rng);
+    run<8>(rng);
+    run<16>(rng);
+
+    std::cout << "ok" << std::endl;
+    return 0;
+}